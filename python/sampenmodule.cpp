@@ -3,6 +3,7 @@
 #include <sstream>
 
 #include "sampen_calculator.h"
+#include "sampen_multiscale.h"
 
 using std::ostringstream;
 
@@ -265,11 +266,213 @@ sampen_compute_entropy_uniform(PyObject *self, PyObject *args)
     PyTuple_SetItem(result, 2, PyFloat_FromDouble(b));
     return result;    
 }
+static PyObject* 
+sampen_compute_entropy_qr_sweep(PyObject *self, PyObject *args)
+{
+    if (PyTuple_Size(args) != 6) 
+    {
+        PyErr_SetString(PyExc_TypeError, "Requires exactly six arguments: data, m, r, sample_sizes, sample_num, presort");
+        return nullptr;
+    }
+    vector<int> data = List2Vector(PyTuple_GetItem(args, 0));
+    unsigned long m = PyLong_AsUnsignedLong(PyTuple_GetItem(args, 1));
+    if (m == static_cast<unsigned long>(-1)) 
+    {
+        if (PyErr_ExceptionMatches(PyExc_TypeError)) 
+        {
+            PyErr_SetString(PyExc_TypeError, "m should be a positive integer. ");
+            return nullptr;
+        }
+    }
+    if (m > 10) 
+    {
+        PyErr_SetString(PyExc_TypeError, "m should be an integer ranging from 1 to 10");
+        return nullptr;
+    }
+    long r = PyLong_AsLong(PyTuple_GetItem(args, 2));
+    if (r == -1 && PyErr_ExceptionMatches(PyExc_TypeError))
+    {
+        PyErr_SetString(PyExc_TypeError, "r should be a positive integer. ");
+        return nullptr;
+    }
+    if (r < 0) 
+    {
+        ostringstream oss;
+        oss << "r is supposed to be positive. ";
+        PyErr_SetString(PyExc_TypeError, oss.str().c_str());
+        return nullptr;
+    }
+
+    PyObject *py_sizes = PyTuple_GetItem(args, 3);
+    if (!PyList_Check(py_sizes)) 
+    {
+        PyErr_SetString(PyExc_TypeError, "sample_sizes should be a list of increasing positive integers. ");
+        return nullptr;
+    }
+    vector<int> sizes = List2Vector(py_sizes);
+    if (PyErr_Occurred()) return nullptr;
+    for (unsigned i = 0; i < sizes.size(); i++) 
+    {
+        if (sizes[i] <= 0 || (i && sizes[i] < sizes[i - 1])) 
+        {
+            PyErr_SetString(PyExc_TypeError, "sample_sizes should be a list of increasing positive integers. ");
+            return nullptr;
+        }
+    }
+    vector<unsigned> sample_sizes(sizes.cbegin(), sizes.cend());
+
+    long sample_num = PyLong_AsLong(PyTuple_GetItem(args, 4));
+    if (sample_num == -1 && PyErr_ExceptionMatches(PyExc_TypeError))
+    {
+        PyErr_SetString(PyExc_TypeError, "sample_num should be a positive integer. ");
+        return nullptr;
+    }
+    if (sample_num < 0) 
+    {
+        ostringstream oss;
+        oss << "sample_num (" << sample_num << ") is supposed to be positive. ";
+        PyErr_SetString(PyExc_TypeError, oss.str().c_str());
+        return nullptr;
+    }
+
+    int presort = PyObject_IsTrue(PyTuple_GetItem(args, 5));
+    if (presort == -1) 
+    {
+        PyErr_SetString(PyExc_TypeError, "presort should be of bool type. ");
+        return nullptr;
+    }
+
+    vector<SampenEstimate> estimates;
+    try 
+    {
+        estimates = ComputeSampenQRSweep(
+            data, static_cast<unsigned>(m), static_cast<int>(r), 
+            sample_sizes, static_cast<unsigned>(sample_num), presort);
+    }
+    catch (const std::exception &e) 
+    {
+        PyErr_SetString(PyExc_ValueError, e.what());
+        return nullptr;
+    }
+
+    PyObject *result = PyList_New(estimates.size());
+    if (result == nullptr) 
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate a list. ");
+        return nullptr;
+    }
+    for (unsigned i = 0; i < estimates.size(); i++) 
+    {
+        PyObject *item = Py_BuildValue(
+            "(ddd)", estimates[i].sampen, estimates[i].a, estimates[i].b);
+        if (item == nullptr) 
+        {
+            Py_DECREF(result);
+            return nullptr;
+        }
+        PyList_SetItem(result, i, item);
+    }
+    return result;
+}
+
+static PyObject* 
+sampen_compute_multiscale_entropy(PyObject *self, PyObject *args)
+{
+    if (PyTuple_Size(args) != 5) 
+    {
+        PyErr_SetString(PyExc_TypeError, "Requires exactly five arguments: data, m, r, max_scale, composite");
+        return nullptr;
+    }
+    vector<int> data = List2Vector(PyTuple_GetItem(args, 0));
+    unsigned long m = PyLong_AsUnsignedLong(PyTuple_GetItem(args, 1));
+    if (m == static_cast<unsigned long>(-1)) 
+    {
+        if (PyErr_ExceptionMatches(PyExc_TypeError)) 
+        {
+            PyErr_SetString(PyExc_TypeError, "m should be a positive integer. ");
+            return nullptr;
+        }
+    }
+    if (m > 10) 
+    {
+        PyErr_SetString(PyExc_TypeError, "m should be an integer ranging from 1 to 10");
+        return nullptr;
+    }
+    long r = PyLong_AsLong(PyTuple_GetItem(args, 2));
+    if (r == -1 && PyErr_ExceptionMatches(PyExc_TypeError))
+    {
+        PyErr_SetString(PyExc_TypeError, "r should be a positive integer. ");
+        return nullptr;
+    }
+    if (r < 0) 
+    {
+        ostringstream oss;
+        oss << "r is supposed to be positive. ";
+        PyErr_SetString(PyExc_TypeError, oss.str().c_str());
+        return nullptr;
+    }
+
+    long max_scale = PyLong_AsLong(PyTuple_GetItem(args, 3));
+    if (max_scale == -1 && PyErr_ExceptionMatches(PyExc_TypeError))
+    {
+        PyErr_SetString(PyExc_TypeError, "max_scale should be a positive integer. ");
+        return nullptr;
+    }
+    if (max_scale <= 0) 
+    {
+        ostringstream oss;
+        oss << "max_scale (" << max_scale << ") is supposed to be positive. ";
+        PyErr_SetString(PyExc_TypeError, oss.str().c_str());
+        return nullptr;
+    }
+
+    int composite = PyObject_IsTrue(PyTuple_GetItem(args, 4));
+    if (composite == -1) 
+    {
+        PyErr_SetString(PyExc_TypeError, "composite should be of bool type. ");
+        return nullptr;
+    }
+
+    vector<MultiscaleEntropy> entropies;
+    try 
+    {
+        entropies = ComputeMultiscaleEntropy(
+            data, static_cast<unsigned>(m), static_cast<int>(r), 
+            static_cast<unsigned>(max_scale), composite);
+    }
+    catch (const std::exception &e) 
+    {
+        PyErr_SetString(PyExc_ValueError, e.what());
+        return nullptr;
+    }
+
+    PyObject *result = PyList_New(entropies.size());
+    if (result == nullptr) 
+    {
+        PyErr_SetString(PyExc_MemoryError, "Cannot allocate a list. ");
+        return nullptr;
+    }
+    for (unsigned i = 0; i < entropies.size(); i++) 
+    {
+        PyObject *item = Py_BuildValue(
+            "(ddd)", entropies[i].mse, entropies[i].cmse, entropies[i].rcmse);
+        if (item == nullptr) 
+        {
+            Py_DECREF(result);
+            return nullptr;
+        }
+        PyList_SetItem(result, i, item);
+    }
+    return result;
+}
+
 static PyMethodDef sampen_methods[] = 
 {
     {"compute_sampen_direct", sampen_compute_entropy_direct, METH_VARARGS, "Compute sample entropy using direct method. "}, 
     {"compute_sampen_qr", sampen_compute_entropy_qr, METH_VARARGS, "Compute sample entropy using quasi-Monte Carlo sampling. "}, 
     {"compute_sampen_uniform", sampen_compute_entropy_uniform, METH_VARARGS, "Compute sample entropy using quasi-Monte Carlo sampling. "}, 
+    {"compute_multiscale_entropy", sampen_compute_multiscale_entropy, METH_VARARGS, "Compute multiscale sample entropy (mse, cmse, rcmse) for the scales 1, ..., max_scale. "}, 
+    {"compute_sampen_qr_sweep", sampen_compute_entropy_qr_sweep, METH_VARARGS, "Compute sample entropy using quasi-Monte Carlo sampling for each of the increasing sample sizes. "}, 
     {nullptr, nullptr, 0, nullptr}
 };
 
@@ -6,6 +6,8 @@
 PyObject* sampen_compute_entropy_direct(PyObject *self, PyObject *args);
 PyObject* sampen_compute_entropy_qr(PyObject *self, PyObject *args);
 PyObject* sampen_compute_entropy_uniform(PyObject *self, PyObject *args);
+PyObject* sampen_compute_entropy_qr_sweep(PyObject *self, PyObject *args);
+PyObject* sampen_compute_multiscale_entropy(PyObject *self, PyObject *args);
 extern "C"
 {
 PyMODINIT_FUNC PyInit_sampen(void);
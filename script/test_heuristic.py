@@ -31,9 +31,10 @@ for signal in signals:
 
     A_errs = []
     B_errs = []
-    for sample_size in sample_sizes:
-      sampen_qr, B_qr, A_qr = compute_sampen_qr(
-          data, m, r_scaled, sample_size, sample_num, True)
+    # One sweep grows the sample instead of a run for each sample size
+    results = compute_sampen_qr_sweep(
+        data, m, r_scaled, sample_sizes, sample_num, True)
+    for sample_size, (sampen_qr, B_qr, A_qr) in zip(sample_sizes, results):
 
       B_qr_norm = B_qr / sample_size / sample_size 
       A_qr_norm = A_qr / sample_size / sample_size 
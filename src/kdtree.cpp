@@ -64,15 +64,28 @@ void NewKDTree::BuildKDTree_(unsigned max_level)
 }
 
 vector<Point> NewKDTree::Sample(unsigned sample_size) 
+{
+    vector<unsigned> indices = SampleIndices(sample_size);
+    vector<Point> result(sample_size);
+    for (unsigned i = 0; i < sample_size; i++) 
+    {
+        result[i] = points_[indices[i]];
+    }
+    return result;
+}
+
+vector<unsigned> NewKDTree::SampleIndices(unsigned sample_size) 
 {
     if (sample_size != node_ptrs_.size()) 
         throw std::invalid_argument("sample_size != node_ptrs_.size()");
-    vector<Point> result(sample_size);
+    vector<unsigned> result(sample_size);
     uniform_int_generator uig(0, node_ptrs_[0]->count() - 1, 
         uniform_int_generator::QUASI, true);
-    for (int i = 0; i < sample_size; i++) 
+    uig.fill(result);
+    for (unsigned i = 0; i < sample_size; i++) 
     {
-        result[i] = *(node_ptrs_[i]->point_ptrs()[uig.get()]);
+        const Point *p = node_ptrs_[i]->point_ptrs()[result[i]];
+        result[i] = static_cast<unsigned>(p - points_.data());
     }
     return result;
 }
@@ -203,6 +216,16 @@ struct kdtree *_create_kdtree_node(
 }
 
 
+void free_kdtree(struct kdtree *tree)
+{
+    if (!tree) return;
+    free_kdtree(tree->lc);
+    free_kdtree(tree->rc);
+    free(tree->range);
+    free(tree);
+}
+
+
 /*
  * Insert a data point of length m to 
  */
@@ -314,4 +337,57 @@ long long count_range_kdtree(struct kdtree *tree, const int *point,
         return count;
     }
     }
-}
\ No newline at end of file
+}
+
+double count_range_kdtree_approx(struct kdtree *tree, const int *point,
+                                 unsigned m, int r, unsigned max_nump)
+{
+    if (!tree) return 0;
+    enum CASE
+    {
+        NOT_INTER,
+        WITHIN,
+        INTER
+    };
+    enum CASE _case = WITHIN;
+    /* the fraction of the volume of the node covered by the range */
+    double fraction = 1.;
+    unsigned i;
+    for (i = 0; i < m; i++)
+    {
+        int lower = tree->range[2 * i], upper = tree->range[2 * i + 1];
+        if (lower > point[i] + r || upper < point[i] - r)
+        {
+            _case = NOT_INTER;
+            break;
+        }
+        if (lower < point[i] - r || upper > point[i] + r)
+        {
+            _case = INTER;
+            int overlap = std::min(upper, point[i] + r) - 
+                std::max(lower, point[i] - r) + 1;
+            fraction *= static_cast<double>(overlap) / (upper - lower + 1);
+        }
+    }
+    switch (_case)
+    {
+    case NOT_INTER:
+        return 0;
+    case WITHIN:
+        return tree->nump;
+    case INTER:
+    {
+        if (tree->nump <= max_nump || !(tree->lc || tree->rc)) 
+        {
+            return tree->nump * fraction;
+        }
+        double count = 0;
+        if (tree->lc) count += count_range_kdtree_approx(
+            tree->lc, point, m, r, max_nump);
+        if (tree->rc) count += count_range_kdtree_approx(
+            tree->rc, point, m, r, max_nump);
+        return count;
+    }
+    }
+    return 0;
+}
@@ -79,6 +79,8 @@ public:
         BuildKDTree_(max_level);
     }
     vector<Point> Sample(unsigned sample_size);
+    // Sample one point from each leaf, returning the indices of the points
+    vector<unsigned> SampleIndices(unsigned sample_size);
     vector<shared_ptr<const KDTreeNode> > get_node_ptrs() const 
     {
         return node_ptrs_;
@@ -124,6 +126,20 @@ struct kdtree *build_kdtree_grid(const int *data, unsigned long N,
 long long count_range_kdtree(struct kdtree *tree, const int *point, 
                              unsigned m, int r);
 
+/*
+ * Approximately count the points in [point - r, point + r]. Nodes which 
+ * intersect the range partially and contain no more than max_nump points 
+ * are not descended, their contribution is estimated by the fraction of 
+ * their volume covered by the range.
+ */
+double count_range_kdtree_approx(struct kdtree *tree, const int *point, 
+                                 unsigned m, int r, unsigned max_nump);
+
+/*
+ * Free a kd tree created by build_kdtree or build_kdtree_grid
+ */
+void free_kdtree(struct kdtree *tree);
+
 /* 
  * Create a kd tree node given range, m, ...
  *
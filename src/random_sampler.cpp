@@ -1,42 +1,113 @@
 #include <iostream>
 #include <chrono>
 #include <algorithm>
-#include <list>
 
 #include <math.h>
 #include <stdlib.h>
 #include <random>
 
-#include <gsl/gsl_qrng.h>
-
 #include "random_sampler.h"
-#include "tensor.h"
 
 using std::vector;
-using std::list;
 
-unsigned powu(unsigned x, unsigned u) 
+Philox4x32::Philox4x32(unsigned long long seed, unsigned long long stream)
+    : stream_(stream), offset_(0)
+{
+    key_[0] = static_cast<uint32_t>(seed);
+    key_[1] = static_cast<uint32_t>(seed >> 32);
+}
+
+void Philox4x32::discard(unsigned long long n)
+{
+    offset_ += n;
+    if (offset_ & 3) _Generate(offset_ >> 2);
+}
+
+void Philox4x32::_Generate(unsigned long long block)
 {
-    unsigned result = x;
-    for (unsigned i = 1; i < u; i++)
+    const uint32_t kMul0 = 0xD2511F53u, kMul1 = 0xCD9E8D57u;
+    const uint32_t kWeyl0 = 0x9E3779B9u, kWeyl1 = 0xBB67AE85u;
+    uint32_t c0 = static_cast<uint32_t>(block);
+    uint32_t c1 = static_cast<uint32_t>(block >> 32);
+    uint32_t c2 = static_cast<uint32_t>(stream_);
+    uint32_t c3 = static_cast<uint32_t>(stream_ >> 32);
+    uint32_t k0 = key_[0], k1 = key_[1];
+    for (unsigned i = 0; i < 10; i++)
     {
-        result *= x;
+        uint64_t p0 = static_cast<uint64_t>(kMul0) * c0;
+        uint64_t p1 = static_cast<uint64_t>(kMul1) * c2;
+        uint32_t hi0 = static_cast<uint32_t>(p0 >> 32);
+        uint32_t lo0 = static_cast<uint32_t>(p0);
+        uint32_t hi1 = static_cast<uint32_t>(p1 >> 32);
+        uint32_t lo1 = static_cast<uint32_t>(p1);
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+        k0 += kWeyl0;
+        k1 += kWeyl1;
+    }
+    out_[0] = c0;
+    out_[1] = c1;
+    out_[2] = c2;
+    out_[3] = c3;
+}
+
+unsigned long long GetSeed(bool real_random)
+{
+    if (!real_random) return 0;
+    return std::chrono::system_clock::now().time_since_epoch().count();
+}
+
+// Lemire's multiply-shift with rejection, 32-bit spans only need one output
+unsigned long long RandomBounded(Philox4x32 &eng, unsigned long long span)
+{
+    if (span == 0) 
+        throw std::invalid_argument("span == 0");
+    if (span <= 0xFFFFFFFFull) 
+    {
+        uint32_t s = static_cast<uint32_t>(span);
+        uint64_t m = static_cast<uint64_t>(eng()) * span;
+        uint32_t l = static_cast<uint32_t>(m);
+        if (l < s) 
+        {
+            // 2^32 mod span
+            uint32_t t = (0u - s) % s;
+            while (l < t) 
+            {
+                m = static_cast<uint64_t>(eng()) * span;
+                l = static_cast<uint32_t>(m);
+            }
+        }
+        return m >> 32;
+    }
+    // Rejection on the smallest power-of-two range covering span
+    unsigned long long mask = span - 1;
+    for (unsigned i = 1; i < 64; i <<= 1) mask |= mask >> i;
+    while (true) 
+    {
+        unsigned long long x = eng();
+        x = (x << 32 | eng()) & mask;
+        if (x < span) return x;
     }
-    return result;
 }
 
-// random generator function
-int randomfunc(int j)
+double RandomReal(Philox4x32 &eng)
 {
-    return rand() % j;
+    uint64_t hi = eng() >> 5, lo = eng() >> 6;
+    return (hi * 67108864. + lo) / 9007199254740992.;
 }
 
-vector<unsigned> random_permutation(unsigned n)
+vector<unsigned> random_permutation(unsigned n, Philox4x32 &eng)
 {
     vector<unsigned> result(n);
     for (unsigned i = 0; i < n; i++)
     result[i] = i;
-    std::random_shuffle(result.begin(), result.end(), randomfunc);
+    for (unsigned i = n; i > 1; i--)
+    {
+        unsigned j = static_cast<unsigned>(RandomBounded(eng, i));
+        std::swap(result[i - 1], result[j]);
+    }
     return result;
 }
 
@@ -45,24 +116,10 @@ void uniform_int_generator::init_state()
     if (rangel > ranger) 
     throw std::invalid_argument("rangel is larger than ranger.");
 
-    if (real_random) 
-    {
-        std::random_device rd;
-        eng.seed(std::chrono::system_clock::now().time_since_epoch().count());
-    }
-    else 
-    {
-        eng.seed(0); 
-    }
-    if (rtype == PSEUDO) 
-    {
-        uid = std::uniform_int_distribution<int>(rangel, ranger);
-    }
-    else if (rtype == QUASI) 
-    {
-        qrng = gsl_qrng_alloc(gsl_qrng_sobol, 1);
-    }
-    else if (rtype == SHUFFLE)
+    eng = Philox4x32(GetSeed(real_random), stream);
+    sobol_index = 0;
+    sobol_point = 0;
+    if (rtype == SHUFFLE)
     {
         throw std::runtime_error("SHUFFULE not implemented.");
     }
@@ -74,12 +131,11 @@ int uniform_int_generator::get()
     switch (rtype)
     {
     case PSEUDO:
-        sample = uid(eng);
+        sample = rangel + static_cast<int>(RandomBounded(
+            eng, static_cast<long long>(ranger) - rangel + 1));
         break;
     case QUASI:
-        double v;
-        gsl_qrng_get(qrng, &v);
-        sample = static_cast<int>(v * (ranger - rangel) + rangel);
+        sample = scale_sobol(next_sobol());
         break;
     case SHUFFLE:
         throw std::runtime_error("SHUFFULE not implemented.");
@@ -88,62 +144,219 @@ int uniform_int_generator::get()
     return sample;
 }
 
+void uniform_int_generator::fill(int *out, size_t n)
+{
+    if (rtype == PSEUDO) 
+    {
+        unsigned long long span = static_cast<long long>(ranger) - rangel + 1;
+        for (size_t i = 0; i < n; i++)
+            out[i] = rangel + static_cast<int>(RandomBounded(eng, span));
+    }
+    else if (rtype == QUASI) 
+    {
+        // Generate the points of a block first, so that the scaling is a 
+        // plain loop the compiler vectorizes
+        const size_t kBlock = 256;
+        uint32_t points[kBlock];
+        for (size_t begin = 0; begin < n; begin += kBlock)
+        {
+            size_t len = std::min(kBlock, n - begin);
+            for (size_t i = 0; i < len; i++)
+                points[i] = next_sobol();
+            for (size_t i = 0; i < len; i++)
+                out[begin + i] = scale_sobol(points[i]);
+        }
+    }
+    else 
+    {
+        throw std::runtime_error("SHUFFULE not implemented.");
+    }
+}
 
-vector<vector<Point> > sample_hist(const vector<Point> &vec, int r, 
-                                   int max_data, int min_data, 
-                                   double sample_rate)
+void uniform_int_generator::fill(unsigned *out, size_t n)
+{
+    if (rangel < 0) 
+        throw std::invalid_argument("rangel is negative.");
+    fill(reinterpret_cast<int *>(out), n);
+}
+
+// The n-th point of the Sobol sequence of dimension 1 is the bit reversal 
+// of the Gray code of n
+void uniform_int_generator::discard(unsigned long long n)
 {
-    // Construct histogram
-    unsigned num_grid = (max_data - min_data) / r + 1;
-    unsigned dim = vec[0].dim();
+    if (rtype == PSEUDO) 
+    {
+        eng.discard(n);
+        return;
+    }
+    sobol_index += n;
+    uint32_t gray = static_cast<uint32_t>(sobol_index ^ (sobol_index >> 1));
+    uint32_t x = gray;
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+    x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+    sobol_point = (x >> 16) | (x << 16);
+}
 
-    vector<unsigned> size(dim, num_grid);
 
-    tensor<list<const Point *> > hist(size);
-    for (unsigned i = 0; i < vec.size(); i++)
+alias_table::alias_table(const vector<double> &weights)
+    : prob_(weights.size()), alias_(weights.size())
+{
+    unsigned n = weights.size();
+    if (n == 0) 
+        throw std::invalid_argument("weights is empty");
+    double sum = 0;
+    for (unsigned i = 0; i < n; i++) 
     {
-        vector<unsigned> idx(dim);
-        for (unsigned j = 0; j < dim; j++)
+        if (!(weights[i] >= 0)) 
+            throw std::invalid_argument("weights should be non-negative");
+        sum += weights[i];
+    }
+    if (!(sum > 0)) 
+        throw std::invalid_argument("weights should not be all zero");
+
+    // Columns with less than the average weight are filled by the others
+    vector<unsigned> small, large;
+    for (unsigned i = 0; i < n; i++) 
+    {
+        prob_[i] = weights[i] * n / sum;
+        alias_[i] = i;
+        if (prob_[i] < 1) small.push_back(i);
+        else large.push_back(i);
+    }
+    while (!small.empty() && !large.empty()) 
+    {
+        unsigned s = small.back(), l = large.back();
+        small.pop_back();
+        alias_[s] = l;
+        prob_[l] -= 1 - prob_[s];
+        if (prob_[l] < 1) 
         {
-            idx[j] = (vec[i][j] - min_data) / r;
+            large.pop_back();
+            small.push_back(l);
         }
-        hist[idx].push_front(vec.data() + i);
     }
+    // The remaining columns are full up to rounding errors
+    for (unsigned i : small) prob_[i] = 1;
+    for (unsigned i : large) prob_[i] = 1;
+}
 
-    unsigned num_sample = static_cast<unsigned>(1 / sample_rate) + 1;
-    unsigned size_sample = static_cast<unsigned>(vec.size() * sample_rate) * 3;
-    vector<vector<Point> > results(num_sample, vector<Point>(size_sample));
-    vector<unsigned> counts(num_sample, 0);
+// The second dimension uses the primitive polynomial x + 1 with m_1 = 1
+sobol_generator_2d::sobol_generator_2d() : index_(0), x_(0), y_(0)
+{
+    direction_[0] = 0x80000000u;
+    for (unsigned k = 1; k < 32; k++)
+        direction_[k] = direction_[k - 1] ^ (direction_[k - 1] >> 1);
+}
 
-    // Do sampling!
-    for (unsigned i = 0; i < powu(num_grid, size.size()); i++)
+void sobol_generator_2d::discard(unsigned long long n)
+{
+    index_ += n;
+    uint32_t gray = static_cast<uint32_t>(index_ ^ (index_ >> 1));
+    x_ = y_ = 0;
+    for (unsigned k = 0; k < 32; k++)
     {
-        unsigned len = hist[i].size();
-        vector<unsigned> perm = random_permutation(
-            (len / size_sample + 1) * size_sample);
-
-        for (unsigned j = 0; j < len; j++)
+        if (gray >> k & 1) 
         {
-            unsigned idx = perm[j] % num_sample;
-            results[idx][counts[idx]] = *hist[i].front();
-#ifdef DEBUG
-            std::cout << "counts[" << idx << "] = " << counts[idx] << std::endl;
-            hist[i].front()->print();
-#endif
-            hist[i].pop_front();
-            counts[idx]++;
+            x_ ^= 0x80000000u >> k;
+            y_ ^= direction_[k];
         }
     }
+}
 
-    for (unsigned i = 0; i < results.size(); i++)
+/*
+ * Sample n items of dimension dim by histogram, coord(i, d) is the d-th 
+ * coordinate of the i-th item. The items are put into the cells of width r 
+ * of a grid, which is a CellTable of the occupied cells, and the items of 
+ * each cell are spread over the samples by a random permutation of the 
+ * cell.
+ */
+template <class Coord>
+static vector<vector<unsigned> > _SampleHist(
+    unsigned n, unsigned dim, const Coord &coord, int r, int min_data, 
+    double sample_rate)
+{
+    if (r <= 0) 
+        throw std::invalid_argument("r should be positive");
+    if (!(sample_rate > 0 && sample_rate <= 1)) 
+        throw std::invalid_argument("sample_rate should be in (0, 1]");
+    auto cell = [&](unsigned i, unsigned d) 
+    {
+        return (static_cast<long long>(coord(i, d)) - min_data) / r;
+    };
+
+    // Number the occupied cells in the order of their first items
+    CellTable table(dim, n);
+    vector<unsigned> cell_of(n);
+    vector<long long> cell_i(dim);
+    for (unsigned i = 0; i < n; i++) 
+    {
+        for (unsigned d = 0; d < dim; d++) cell_i[d] = cell(i, d);
+        cell_of[i] = table.Insert(cell_i.data());
+    }
+
+    // Items of cell c are items[offsets[c]], ..., items[offsets[c + 1] - 1]
+    unsigned num_cells = table.size();
+    vector<unsigned> offsets(num_cells + 1, 0);
+    for (unsigned i = 0; i < n; i++) offsets[cell_of[i] + 1]++;
+    for (unsigned c = 0; c < num_cells; c++) offsets[c + 1] += offsets[c];
+    vector<unsigned> items(n);
+    vector<unsigned> pos(offsets.begin(), offsets.end() - 1);
+    for (unsigned i = 0; i < n; i++) items[pos[cell_of[i]]++] = i;
+
+    // Spread the items of each cell, one random stream for each cell
+    unsigned num_sample = static_cast<unsigned>(1 / sample_rate) + 1;
+    unsigned size_sample = std::max(
+        static_cast<unsigned>(n * sample_rate) * 3, 1u);
+    vector<unsigned> sample_of(n);
+    ParallelFor(num_cells, [&](unsigned begin, unsigned end) 
     {
-        results[i].resize(counts[i]);
+        for (unsigned c = begin; c < end; c++) 
+        {
+            unsigned len = offsets[c + 1] - offsets[c];
+            Philox4x32 eng(0, c);
+            vector<unsigned> perm = random_permutation(
+                (len / size_sample + 1) * size_sample, eng);
+            for (unsigned j = 0; j < len; j++) 
+                sample_of[items[offsets[c] + j]] = perm[j] % num_sample;
+        }
+    }, 256);
 
+    vector<vector<unsigned> > results(num_sample);
+    for (unsigned k = 0; k < n; k++) 
+        results[sample_of[items[k]]].push_back(items[k]);
 #ifdef DEBUG
-        std::cout << counts[i] << std::endl;
-        std::for_each(results[i].begin(), results[i].end(), 
-                      [](const Point &p) { p.print(); });
+    for (unsigned i = 0; i < results.size(); i++)
+        std::cout << results[i].size() << std::endl;
 #endif
+    return results;
+}
+
+vector<vector<Point> > sample_hist(const vector<Point> &vec, int r, 
+                                   int /* max_data */, int min_data, 
+                                   double sample_rate)
+{
+    if (vec.empty()) return vector<vector<Point> >();
+    auto coord = [&](unsigned i, unsigned d) { return vec[i][d]; };
+    vector<vector<unsigned> > indices = _SampleHist(
+        vec.size(), vec[0].dim(), coord, r, min_data, sample_rate);
+    vector<vector<Point> > results(indices.size());
+    for (unsigned k = 0; k < indices.size(); k++) 
+    {
+        results[k].reserve(indices[k].size());
+        for (unsigned i : indices[k]) results[k].push_back(vec[i]);
     }
     return results;
 }
+
+vector<vector<unsigned> > sample_hist(const vector<int> &data, unsigned dim, 
+                                      int r, int min_data, 
+                                      double sample_rate)
+{
+    if (dim == 0 || data.size() < dim) 
+        throw std::invalid_argument("data.size() < dim");
+    auto coord = [&](unsigned i, unsigned d) { return data[i + d]; };
+    return _SampleHist(data.size() - dim + 1, dim, coord, r, min_data, 
+                       sample_rate);
+}
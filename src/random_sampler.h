@@ -10,12 +10,59 @@
 
 #include <vector>
 #include <random>
-#include <gsl/gsl_qrng.h>
+#include <stdint.h>
+#include <stddef.h>
 #include "RangeTree2.h"
 #include "utils.h"
 
 using std::vector;
 
+/*
+ * Counter-based generator Philox4x32-10 (Salmon et al., SC'11). The i-th 
+ * output is a function of (seed, stream, i) only, so that the generators 
+ * of different streams are independent and can be used by different 
+ * threads, and jumping ahead is O(1).
+ */
+class Philox4x32
+{
+public:
+    typedef uint32_t result_type;
+    explicit Philox4x32(unsigned long long seed = 0, 
+                        unsigned long long stream = 0);
+    result_type operator()()
+    {
+        unsigned i = offset_ & 3;
+        if (i == 0) _Generate(offset_ >> 2);
+        offset_++;
+        return out_[i];
+    }
+    // Skip the next n outputs
+    void discard(unsigned long long n);
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 0xFFFFFFFFu; }
+private:
+    // Compute the block of four outputs with the given counter
+    void _Generate(unsigned long long block);
+    uint32_t key_[2];
+    unsigned long long stream_;
+    // The number of outputs consumed
+    unsigned long long offset_;
+    uint32_t out_[4];
+};
+
+// The seed of the generators, the clock if real_random and 0 otherwise
+unsigned long long GetSeed(bool real_random);
+
+// Uniform integer in [0, span) without modulo bias, the result is the same 
+// on all platforms unlike std::uniform_int_distribution.
+unsigned long long RandomBounded(Philox4x32 &eng, unsigned long long span);
+
+// Uniform double in [0, 1) with 53 random bits
+double RandomReal(Philox4x32 &eng);
+
+// Random permutation of 0, ..., n - 1 by Fisher-Yates shuffle
+vector<unsigned> random_permutation(unsigned n, Philox4x32 &eng);
+
 class uniform_int_generator
 {
 public:
@@ -23,34 +70,107 @@ public:
     /*
      * @param _rangel: minimun value
      * @param _ranger: maximum value 
+     * @param _stream: generators with different streams give independent 
+     *   pseudo-random sequences, e.g., one stream for each sampling round, 
+     *   or (round << 32 | thread) when a round is split over threads
      */
     uniform_int_generator(
-        int _rangel, int _ranger, random_type _rtype, bool _random = false): 
+        int _rangel, int _ranger, random_type _rtype, bool _random = false, 
+        unsigned long long _stream = 0): 
             rangel(_rangel), ranger(_ranger), rtype(_rtype), 
-            real_random(_random)
+            real_random(_random), stream(_stream)
     {
         init_state();
     }
-    ~uniform_int_generator() 
-    {
-        if (rtype == QUASI) 
-        {
-            gsl_qrng_free(qrng); 
-        }
-    }
     int get();
+    /*
+     * Generate n samples in one call, which is much cheaper than n calls 
+     * of get(). The samples are the same as those of get().
+     */
+    void fill(int *out, size_t n);
+    void fill(vector<int> &out) { fill(out.data(), out.size()); }
+    // Same as above for non-negative ranges, e.g., template indices
+    void fill(unsigned *out, size_t n);
+    void fill(vector<unsigned> &out) { fill(out.data(), out.size()); }
+    // Skip the next n samples
+    void discard(unsigned long long n);
 private:
     int rangel, ranger;
     const uniform_int_generator::random_type rtype;
-    std::uniform_int_distribution<int> uid;
-    std::default_random_engine eng;
-    gsl_qrng *qrng;
+    Philox4x32 eng;
+    // Number of quasi-random points generated and the last point of the 
+    // Sobol sequence in 32-bit fixed point
+    unsigned long long sobol_index;
+    uint32_t sobol_point;
     int sample;
     // Whether to set seed randomly.
     bool real_random;
+    unsigned long long stream;
+    // Next point of the Sobol sequence in 32-bit fixed point
+    uint32_t next_sobol()
+    {
+        sobol_index++;
+        sobol_point ^= 0x80000000u >> __builtin_ctzll(sobol_index);
+        return sobol_point;
+    }
+    // Map a 32-bit fixed point in [0, 1) to [rangel, ranger)
+    int scale_sobol(uint32_t x) const
+    {
+        uint64_t span = static_cast<uint64_t>(
+            static_cast<long long>(ranger) - rangel);
+        return static_cast<int>(rangel + static_cast<long long>(
+            (static_cast<uint64_t>(x) * span) >> 32));
+    }
     void init_state();
 };
 
+/*
+ * Walker's alias table built by Vose's method in O(n), which draws index i 
+ * with probability proportional to weights[i] in O(1).
+ */
+class alias_table
+{
+public:
+    alias_table() {}
+    explicit alias_table(const vector<double> &weights);
+    unsigned sample(Philox4x32 &eng) const
+    {
+        unsigned i = static_cast<unsigned>(RandomBounded(eng, prob_.size()));
+        return RandomReal(eng) < prob_[i] ? i : alias_[i];
+    }
+    unsigned size() const { return prob_.size(); }
+private:
+    // Column i keeps i with probability prob_[i], and alias_[i] otherwise
+    vector<double> prob_;
+    vector<unsigned> alias_;
+};
+
+/*
+ * Sobol sequence of dimension 2 in 32-bit fixed point, generated in 
+ * Gray-code order. The first coordinate is the same sequence as the QUASI 
+ * uniform_int_generator.
+ */
+class sobol_generator_2d
+{
+public:
+    sobol_generator_2d();
+    void next(uint32_t *x, uint32_t *y)
+    {
+        index_++;
+        unsigned k = __builtin_ctzll(index_);
+        x_ ^= 0x80000000u >> k;
+        y_ ^= direction_[k];
+        *x = x_;
+        *y = y_;
+    }
+    // Skip the next n points
+    void discard(unsigned long long n);
+private:
+    uint32_t direction_[32];
+    unsigned long long index_;
+    uint32_t x_, y_;
+};
+
 /*
  * Convert a sequence of data to vector of Points
  */
@@ -61,7 +181,8 @@ vector<Point> GetPoints(const vector<int> &data, unsigned m);
  * 
  * @param vec: the vector of Points
  * @param r: the width of grid of the histogram
- * @param max_data: the maximum of the original data
+ * @param max_data: unused, kept for compatibility, since only the occupied 
+ *   cells are stored and the grid needs no upper bound
  * @param min_data: the minimum of the original data
  * @param sample_rate: the sampling rate
  * @return a vector of vectors of Points
@@ -70,4 +191,15 @@ vector<vector<Point> > sample_hist(const vector<Point> &vec, int r,
                                    int max_data, int min_data, 
                                    double sample_rate);
 
+/* 
+ * The same as above for the templates data[i], ..., data[i + dim - 1], 
+ * 0 <= i <= data.size() - dim. Only the occupied cells of the grid are 
+ * stored, so the memory is linear in the number of templates.
+ * 
+ * @return the indices of the templates of each sample
+ */
+vector<vector<unsigned> > sample_hist(const vector<int> &data, unsigned dim, 
+                                      int r, int min_data, 
+                                      double sample_rate);
+
 #endif // __RANDOM_SAMPLER_H__
@@ -15,6 +15,7 @@
 #include "utils.h"
 #include "RangeTree2.h"
 #include "sampen_calculator.h"
+#include "sampen_planner.h"
 
 using std::vector;
 using std::cout;
@@ -29,6 +30,9 @@ struct stat {
     double r;
     unsigned sample_num;
     unsigned sample_size;
+    double rel_err;
+    double memory;
+    string calibration;
 } _stat;
 
 void phelp(char *arg0);
@@ -39,6 +43,8 @@ int main(int argc, char *argv[]) {
     _stat.r = -1;
     _stat.sample_num = 0;
     _stat.sample_size = 0;
+    _stat.rel_err = 0;
+    _stat.memory = 4e9;
     ParseArgs(argc, argv);
 
     unsigned long N;
@@ -82,6 +88,26 @@ int main(int argc, char *argv[]) {
     cout << "Error = " << error;
     cout << ", Relative Error (Quasi-random) = " << error / result << endl;
 
+    // Compute sample entropy by the method chosen by the planner, whose 
+    // cost model is calibrated once and saved
+    SampenCostModel model = SampenCostModel::Default();
+    if (_stat.calibration.size() && !model.Load(_stat.calibration)) 
+    {
+        cout << "Calibrating the cost model" << endl;
+        model = SampenCostModel::Calibrate();
+        model.Save(_stat.calibration);
+    }
+    SampenCalculatorAuto sc_auto(_stat.rel_err, _stat.memory, model);
+    sc_auto.set_log(&cout);
+    result_random = sc_auto.ComputeEntropy(data, _stat.m, r, nullptr, nullptr);
+    cout << "Auto (" << MethodName(sc_auto.plan().method) << "): SampEn(";
+    cout << _stat.m << ", " << _stat.r << ", ";
+    cout << N << ") = " << result_random << endl;
+
+    error = result_random - result;
+    cout << "Error = " << error;
+    cout << ", Relative Error (Auto) = " << error / result << endl;
+
     //Compute sample entropy by random sampling
     result_random = ComputeSampenQR(
         data, _stat.m, r, _stat.sample_size, _stat.sample_num, 
@@ -159,7 +185,11 @@ void phelp(char *arg0)
 {
     char help[] = "options: \n"
                 "\t-m M (default: 3) template length\n"
-                "\t-r R (default: 100) tolerance\n";
+                "\t-r R (default: 100) tolerance\n"
+                "\t-rel_err E (default: 0) accuracy of the auto method\n"
+                "\t-memory MB (default: 4000) memory of the auto method\n"
+                "\t-calibration FILE cost model of the auto method, which "
+                "is calibrated and saved if FILE does not exist\n";
     cerr << "usage: " << arg0 << "[options] INPUT_FILENAME\n";
     cerr << help;
     exit(-1);
@@ -182,6 +212,14 @@ void ParseArgs(int argc, char *argv[])
     if (arg.size()) _stat.r = std::stod(arg);
     else _stat.r = 0.1;
     
+    arg = ap.getArg("-rel_err");
+    if (arg.size()) _stat.rel_err = std::stod(arg);
+
+    arg = ap.getArg("-memory");
+    if (arg.size()) _stat.memory = std::stod(arg) * 1e6;
+
+    _stat.calibration = ap.getArg("-calibration");
+
     arg = ap.getArg("-sample_num");
     if (arg.size()) _stat.sample_num = std::stoi(arg);
     else throw std::invalid_argument(
@@ -16,145 +16,346 @@
 #include <numeric>
 
 #include "sampen_calculator.h"
+#include "sampen_exact.h"
 #include "random_sampler.h"
 #include "kdtree.h"
 #include "utils.h"
 
 using std::pair;
 
+// Restore a value when leaving the scope, also by an exception
+template <typename T>
+class RestoreOnExit
+{
+public:
+    explicit RestoreOnExit(T &value) : value_(value), saved_(value) {}
+    ~RestoreOnExit() { value_ = saved_; }
+    RestoreOnExit(const RestoreOnExit &) = delete;
+    RestoreOnExit &operator=(const RestoreOnExit &) = delete;
+private:
+    T &value_;
+    const T saved_;
+};
+
+// The cell of each value in each of the grids of width 2r + 1 shifted by 
+// g (2r + 1) / num_grids, cells[g * N + k] for data[k]
+static vector<int> ComputeGridCells(const vector<int> &data, int r, 
+                                    unsigned num_grids)
+{
+    const unsigned N = data.size();
+    const long long w = 2 * static_cast<long long>(r) + 1;
+    vector<int> cells(static_cast<size_t>(num_grids) * N);
+    for (unsigned g = 0; g < num_grids; g++)
+    {
+        const long long offset = g * w / num_grids;
+        for (unsigned k = 0; k < N; k++)
+        {
+            long long v = data[k] + offset;
+            cells[static_cast<size_t>(g) * N + k] = static_cast<int>(
+                v >= 0 ? v / w : -((w - 1 - v) / w));
+        }
+    }
+    return cells;
+}
+
+// The pairs i < j of equal keys, counted by sorting
+static long long CountEqualPairs(vector<uint64_t> &keys)
+{
+    std::sort(keys.begin(), keys.end());
+    long long count = 0;
+    unsigned begin = 0;
+    for (unsigned j = 0; j < keys.size(); j++)
+    {
+        if (keys[j] != keys[begin]) begin = j;
+        count += j - begin;
+    }
+    return count;
+}
+
+// The pairs of the templates with the given indices sharing a cell of each 
+// of the grids, on m and m + 1 coordinates. The cells of a template are 
+// hashed to 64 bits.
+static void CountGridMatched(const vector<int> &cells, unsigned N, 
+                             const vector<unsigned> &indices, unsigned m, 
+                             long long *c_m, long long *c_m1)
+{
+    const unsigned n = indices.size();
+    vector<uint64_t> keys_m(n), keys_m1(n);
+    for (size_t g = 0; g < cells.size() / N; g++)
+    {
+        const int *x = cells.data() + g * N;
+        for (unsigned k = 0; k < n; k++)
+        {
+            uint64_t h = 0x9E3779B97F4A7C15ull;
+            for (unsigned d = 0; d <= m; d++)
+            {
+                if (d == m) keys_m[k] = h;
+                h ^= static_cast<uint32_t>(x[indices[k] + d]) + 
+                    0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+                h *= 0xBF58476D1CE4E5B9ull;
+                h ^= h >> 31;
+            }
+            keys_m1[k] = h;
+        }
+        *c_m += CountEqualPairs(keys_m);
+        *c_m1 += CountEqualPairs(keys_m1);
+    }
+}
+
 vector<long long> SampenCalculatorD::_ComputeAB(
     const vector<int> &data, unsigned m, int r)
 {
+    if (r == 0 && data.size() > m + 1) return CountABEqual(data, m);
     ABCalculatorPointD ABc;
     vector<Point> points = GetPoints(data, m + 1);
     return ABc.ComputeAB(points, r);
 }
 
-vector<long long> SampenCalculatorRT::_ComputeAB(
-    const vector<int> &data, unsigned m, int r) 
+// Uniform distribution sampling
+void SampenCalculatorUniform::_Prepare(const vector<int> &data, unsigned m)
 {
-    ABCalculatorPointRT ABc;
-    vector<Point> points = GetPoints(data, m + 1);
-    return ABc.ComputeAB(points, r);    
+    n_ = data.size() - m;
 }
 
-// Uniform distribution sampling with sorting
-vector<long long> SampenCalculatorUniform::_ComputeAB(
-    const vector<int> &data, unsigned m, int r) 
+void SampenCalculatorUniform::_Sample(
+    unsigned i, vector<unsigned> &indices) const
 {
-    vector<Point> points = GetPoints(data, m + 1);
-    vector<Point> sampled_points(sample_size);
-    
     uniform_int_generator uig(
-        0, points.size()-1, uniform_int_generator::PSEUDO, real_random);
-    ABCalculatorPointD ABc;
-
-    vector<long long> AB(2);
-    vector<long long> ABs(2 * sample_num, 0);
-    for (unsigned i = 0; i < sample_num; i++)
+        0, n_ - 1, uniform_int_generator::PSEUDO, real_random, i);
+    for (unsigned j = 0; j < sample_size; j++)
     {
-        for (unsigned j = 0; j < sample_size; j++)
-        {
-            // generate points
-            unsigned idx = static_cast<unsigned>(uig.get());
-            // vector<int> p(data.cbegin() + idx, data.cbegin() + idx + m + 1);
-            sampled_points[j] = points[idx];
-        }
-        AB = ABc.ComputeAB(sampled_points, r);
-        ABs[2 * i] += AB[0];
-        ABs[2 * i + 1] += AB[1];
-#ifdef DEBUG
-        double normalizer = pow(sample_size - 1., 2.); 
-        std::cout << "A: " << AB[0] << " ("; 
-        std::cout << static_cast<double>(AB[0]) / normalizer << ")\n";
-        std::cout << "B: " << AB[1] << " ("; 
-        std::cout << static_cast<double>(AB[1]) / normalizer << ")\n";
-#endif 
+        indices[j] = static_cast<unsigned>(uig.get());
     }
-    return ABs;
+}
+
+// A pair of independent uniform templates shares a cell if it is one of 
+// the matched pairs, in either order, or the same template
+double SampenCalculatorUniform::_ControlMean(long long matched, 
+                                             unsigned n) const
+{
+    double pairs = 0.5 * sample_size * (sample_size - 1.);
+    return pairs * (2. * matched + kControlGrids * static_cast<double>(n)) / 
+        (static_cast<double>(n) * n);
 }
 
 // Quasi-random sampling with sorting
-vector<long long> SampenCalculatorQR::_ComputeAB(
-    const vector<int> &data, unsigned m, int r) 
+void SampenCalculatorQR::_Prepare(const vector<int> &data, unsigned m)
 {
-    vector<Point> points = GetPoints(data, m + 1);
-    unsigned n = points.size(); 
-    if (presort) {
-        std::sort(points.begin(), points.end(),
-                  [] (const Point &p1, const Point &p2) 
-                  {
-                      for (unsigned i = 0; i < p1.dim(); i++)
-                      {
-                          if (p1[i] > p2[i])
-                              return true;
-                          if (p1[i] < p2[i])
-                              return false;
-                      }
-                      return true;
-                  });
+    unsigned n = data.size() - m; 
+    // The order only depends on the record and m
+    if (order_.size() != n || sorted_m_ != m || sorted_ != presort || 
+        sorted_data_ != data) 
+    {
+        if (presort) 
+        {
+            order_ = SortTemplates(data, m + 1, n, true);
+        }
+        else 
+        {
+            order_.resize(n);
+            for (unsigned i = 0; i < n; i++) 
+                order_[i] = i;
+        }
+        sorted_data_ = data;
+        sorted_m_ = m;
+        sorted_ = presort;
     }
     
     uniform_int_generator uig(
         0, n - 1, uniform_int_generator::QUASI, real_random);
-    ABCalculatorPointD ABc;
+    indices_.resize(sample_size); 
+    uig.fill(indices_);
+}
 
-    uniform_int_generator tmp_uig(
-        0, n - 1, uniform_int_generator::PSEUDO, real_random);
-    vector<long long> AB(2);
-    vector<long long> ABs(2 * sample_num, 0);
-    vector<Point> sampled_points(sample_size);
-    vector<unsigned> indices(sample_size); 
-    vector<unsigned> offsets(sample_num - 1); 
-    for (unsigned j = 0; j < sample_size; j++)
+void SampenCalculatorQR::_Sample(
+    unsigned i, vector<unsigned> &indices) const
+{
+    unsigned n = order_.size(); 
+    unsigned offset = 0;
+    if (i) 
     {
-        indices[j] = static_cast<unsigned>(uig.get());
-        // indices[j] = (n / sample_size) * j;
+        uniform_int_generator uig(
+            0, n - 1, uniform_int_generator::PSEUDO, real_random, i);
+        offset = static_cast<unsigned>(uig.get()); 
     }
-    for (unsigned i = 0; i < sample_num - 1; ++i) 
+    for (unsigned j = 0; j < sample_size; ++j) 
     {
-        offsets[i] = static_cast<unsigned>(tmp_uig.get()); 
+        indices[j] = order_[(indices_[j] + offset) % n];
     }
-    for (unsigned i = 0; i < sample_num; i++)
+}
+
+void SampenCalculatorPair::_Prepare(const vector<int> &data, unsigned m) 
+{
+    n_ = data.size() - m;
+    if (n_ < 2) 
+        throw std::invalid_argument("data.size() < m + 2");
+}
+
+void SampenCalculatorPair::_Sample(
+    unsigned i, vector<unsigned> &indices) const
+{
+    indices.resize(2 * sample_size);
+    if (quasi) 
     {
-        vector<unsigned> tmp_indices(sample_size); 
+        sobol_generator_2d sobol;
+        uint32_t shift_x = 0, shift_y = 0;
         if (i) 
         {
-            unsigned offset = offsets[i - 1]; 
-            for (unsigned j = 0; j < sample_size; ++j) 
-            {
-                tmp_indices[j] = (indices[j] + offset) % n; 
-            }
+            Philox4x32 eng(GetSeed(real_random), i);
+            shift_x = eng();
+            shift_y = eng();
         }
-        else {
-            for (unsigned j = 0; j < sample_size; ++j) 
+        for (unsigned k = 0; k < sample_size; )
+        {
+            uint32_t x, y;
+            sobol.next(&x, &y);
+            x += shift_x;
+            y += shift_y;
+            unsigned p = static_cast<unsigned>(
+                (static_cast<uint64_t>(x) * n_) >> 32);
+            unsigned q = static_cast<unsigned>(
+                (static_cast<uint64_t>(y) * n_) >> 32);
+            if (p == q) continue;
+            indices[2 * k] = std::min(p, q);
+            indices[2 * k + 1] = std::max(p, q);
+            k++;
+        }
+    }
+    else 
+    {
+        uniform_int_generator uig(
+            0, n_ - 1, uniform_int_generator::PSEUDO, real_random, i);
+        for (unsigned k = 0; k < sample_size; )
+        {
+            unsigned p = static_cast<unsigned>(uig.get());
+            unsigned q = static_cast<unsigned>(uig.get());
+            if (p == q) continue;
+            indices[2 * k] = std::min(p, q);
+            indices[2 * k + 1] = std::max(p, q);
+            k++;
+        }
+    }
+}
+
+// The templates are compared on the data directly
+// The pairs are uniform over i < j
+double SampenCalculatorPair::_ControlMean(long long matched, unsigned n) const
+{
+    return sample_size * matched / (0.5 * n * (n - 1.));
+}
+
+void SampenCalculatorPair::_ComputeRounds(
+    const vector<int> &data, unsigned m, int r, 
+    unsigned begin, unsigned end, vector<long long> &ABs) 
+{
+    _RunRounds(begin, end, [&](unsigned i) 
+    {
+        vector<unsigned> indices;
+        _Sample(i, indices);
+        long long A = 0, B = 0, C_m = 0, C_m1 = 0;
+        for (unsigned k = 0; k < sample_size; k++)
+        {
+            const int *x = data.data() + indices[2 * k];
+            const int *y = data.data() + indices[2 * k + 1];
+            for (unsigned g = 0; g < kControlGrids && controls_; g++)
             {
-                tmp_indices[j] = indices[j]; 
+                const int *cells = grid_cells_.data() + 
+                    static_cast<size_t>(g) * data.size();
+                const int *cx = cells + indices[2 * k];
+                const int *cy = cells + indices[2 * k + 1];
+                bool shared = true;
+                for (unsigned d = 0; d < m && shared; d++)
+                    shared = cx[d] == cy[d];
+                C_m += shared;
+                C_m1 += shared && cx[m] == cy[m];
             }
+            bool matched = true;
+            for (unsigned d = 0; d < m && matched; d++)
+                matched = (x[d] - y[d] <= r) && (y[d] - x[d] <= r);
+            if (!matched) continue;
+            A++;
+            B += (x[m] - y[m] <= r) && (y[m] - x[m] <= r);
         }
-        
-        for (unsigned j = 0; j < sample_size; ++j) 
+        ABs[2 * i] = A;
+        ABs[2 * i + 1] = B;
+        if (controls_) 
         {
-            sampled_points[j] = points[tmp_indices[j]];
+            (*controls_)[2 * i] = C_m;
+            (*controls_)[2 * i + 1] = C_m1;
         }
-        AB = ABc.ComputeAB(sampled_points, r);
-        ABs[2 * i] += AB[0];
-        ABs[2 * i + 1] += AB[1];
-#ifdef DEBUG 
-        double normalizer = pow(sample_size - 1., 2.); 
-        std::cout << "A: " << AB[0] << " ("; 
-        std::cout << static_cast<double>(AB[0]) / normalizer << ")\n";
-        std::cout << "B: " << AB[1] << " ("; 
-        std::cout << static_cast<double>(AB[1]) / normalizer << ")\n";
-#endif 
+    });
+}
+
+void SampenCalculatorQuery::_Prepare(const vector<int> &data, unsigned m) 
+{
+    if (!index_ || index_type_ != type || !index_->Match(data, m)) 
+    {
+        switch (type) 
+        {
+        case RANGE_TREE:
+            index_ = std::make_shared<SampenIndexRT>(data, m);
+            break;
+        case KD_TREE:
+            index_ = std::make_shared<SampenIndexKD>(data, m);
+            break;
+        case WIDE_TREE:
+            index_ = std::make_shared<SampenIndexWT>(data, m);
+            break;
+        case SWEEP:
+            index_ = std::make_shared<SampenIndexSweep>(data, m);
+            break;
+        }
+        index_type_ = type;
     }
-    return ABs;
+
+    unsigned n = data.size() - m;
+    uniform_int_generator uig(
+        0, n - 1, uniform_int_generator::QUASI, real_random);
+    indices_.resize(sample_size); 
+    uig.fill(indices_);
+}
+
+void SampenCalculatorQuery::_Sample(
+    unsigned i, vector<unsigned> &indices) const
+{
+    unsigned n = index_->data().size() - index_->m();
+    unsigned offset = 0;
+    if (i) 
+    {
+        uniform_int_generator uig(
+            0, n - 1, uniform_int_generator::PSEUDO, real_random, i);
+        offset = static_cast<unsigned>(uig.get()); 
+    }
+    indices.resize(sample_size);
+    for (unsigned j = 0; j < sample_size; ++j) 
+    {
+        indices[j] = (indices_[j] + offset) % n;
+    }
+}
+
+// A query always matches itself, which is not counted. The data and m are 
+// those of the index built by _Prepare.
+void SampenCalculatorQuery::_ComputeRounds(
+    const vector<int> & /* data */, unsigned /* m */, int r, 
+    unsigned begin, unsigned end, vector<long long> &ABs) 
+{
+    _RunRounds(begin, end, [&](unsigned i) 
+    {
+        vector<unsigned> indices;
+        _Sample(i, indices);
+        std::sort(indices.begin(), indices.end());
+        long long A = 0, B = 0;
+        for (unsigned k = 0; k < sample_size; k++)
+            index_->CountTemplate(indices[k], r, &A, &B);
+        ABs[2 * i] = A - sample_size;
+        ABs[2 * i + 1] = B - sample_size;
+    });
 }
 
 vector<long long> SampenCalculatorNKD::_ComputeAB(
     const vector<int> &data, unsigned m, int r) 
 {
-    ABCalculatorPointD ABc;
+    ABCalculatorFlatD ABc;
 
     vector<long long> AB(2);
     vector<long long> ABs(2 * sample_num_, 0);
@@ -162,10 +363,13 @@ vector<long long> SampenCalculatorNKD::_ComputeAB(
     auto max_level = static_cast<unsigned>(log2(sample_size_));
     vector<Point> points = GetPoints(data, m + 1);
     NewKDTree kdtree(points, max_level);
+    TemplateBuffer sampled;
     for (unsigned i = 0; i < sample_num_; i++)
     {
-        auto sampled_points = kdtree.Sample(sample_size_);
-        AB = ABc.ComputeAB(sampled_points, r);
+        vector<unsigned> indices = kdtree.SampleIndices(sample_size_);
+        std::sort(indices.begin(), indices.end());
+        sampled.Gather(data, indices, m + 1);
+        AB = ABc.ComputeAB(sampled, r);
         ABs[i * 2] = AB[0];
         ABs[i * 2 + 1] = AB[1];
     }
@@ -175,15 +379,11 @@ vector<long long> SampenCalculatorNKD::_ComputeAB(
 vector<long long> SampenCalculatorHG::_ComputeAB(
     const vector<int> &data, unsigned m, int r) 
 {
-    ABCalculatorPointD ABc;
-
-    vector<Point> points = GetPoints(data, m + 1);
-    int max_data = *std::max_element(data.cbegin(), data.cend());
     int min_data = *std::min_element(data.cbegin(), data.cend());
 
     auto start = std::chrono::system_clock::now();
-    vector<vector<Point> > vec_points = sample_hist(
-        points, r, max_data, min_data, _sample_rate);
+    vector<vector<unsigned> > samples = sample_hist(
+        data, m + 1, r, min_data, _sample_rate);
     auto end = std::chrono::system_clock::now();
 
     std::chrono::duration<double> interval = end - start;
@@ -192,11 +392,12 @@ vector<long long> SampenCalculatorHG::_ComputeAB(
     std::cout << interval.count() << "s" << std::endl;
 #endif 
     vector<long long> ABs(2, 0);
-
-    for (unsigned i = 0; i < vec_points.size(); i++)
+    ABCalculatorFlatD ABc;
+    TemplateBuffer templates;
+    for (unsigned i = 0; i < samples.size(); i++)
     {
-        vector<long long> AB(2);
-        AB = ABc.ComputeAB(vec_points[i], r);
+        templates.Gather(data, samples[i], m + 1);
+        vector<long long> AB = ABc.ComputeAB(templates, r);
         ABs[0] += AB[0];
         ABs[1] += AB[1];
     }
@@ -204,136 +405,100 @@ vector<long long> SampenCalculatorHG::_ComputeAB(
     return ABs;
 }
 
-vector<long long> SampenCalculatorKD::_ComputeAB(
-    const vector<int> &data, unsigned m, int r) 
+/*
+ * The sensitivities of the templates of length dim, i.e., the Chebyshev 
+ * distances between the templates and their mean, which are computed by 
+ * the threads in chunks of the templates.
+ */
+vector<double> ComputeSensitivity(const vector<int> &data, unsigned dim)
 {
-    long long A = 0, B = 0;
-    unsigned N = data.size();
-	unsigned n = N - m + 1;
-
-    vector<int> __data = vector<int>(data);
-
-    int **datap = (int **)malloc(n * sizeof(int *));
-
-    for (unsigned i = 0; i < n; i++)
-        datap[i] = __data.data() + i;
-
-	struct kdtree *treem = build_kdtree((const int **)datap, n - 1, m, 0, 0);
-    struct kdtree *treem1 = build_kdtree((const int **)datap, n - 1, m + 1, 0, 0);
-
-    for (unsigned i = 0; i < N - m; i++)
+    unsigned n = data.size() - dim + 1;
+    unsigned num_threads = std::max(std::min(GetNumThreads(), n / 4096), 1u);
+    unsigned chunk = (n + num_threads - 1) / num_threads;
+    auto parallel = [&](const std::function<void(unsigned)> &f) 
     {
-        A += count_range_kdtree(treem, __data.data() + i, m, r);
-    }
-
-    for (unsigned i = 0; i < N - m; i++)
+        vector<std::thread> threads;
+        for (unsigned t = 1; t < num_threads; t++)
+            threads.push_back(std::thread(f, t));
+        f(0);
+        for (auto &thread : threads) thread.join();
+    };
+
+    // The d-th coordinates of the templates are data[d], ..., data[d + n - 1]
+    vector<double> sums(num_threads * (dim + 1), 0);
+    parallel([&](unsigned t) 
     {
-        B += count_range_kdtree(treem1, __data.data() + i, m + 1, r);
-    }
-
-    A -= (N - m);
-    B -= (N - m);
-
-    vector<long long> result(2);
-    result[0] = A;
-    result[1] = B;
-    return result;
-}
-
-Point ComputeMean(const vector<Point> &points)
-{
-    unsigned n = points.size();
-    if (n == 0) throw std::invalid_argument("points.size() == 0");
-    Point result(points[0]);
-    for (unsigned i = 0; i < result.dim(); i++)
-    {
-        vector<double> data(n);
-        for (unsigned j = 0; j < n; j++) 
+        unsigned begin = t * chunk, end = std::min(begin + chunk, n);
+        for (unsigned d = 0; d < dim; d++) 
         {
-            data[j] = points[j][i];
+            double sum = 0;
+            for (unsigned i = begin; i < end; i++) sum += data[i + d];
+            sums[t * (dim + 1) + d] = sum;
         }
-        result[i] = ComputeSum(data) / n;
-    }
-    return result;
-}
-
-unsigned GetInvertalIndex(const vector<double> &pmf, double x) 
-{
-    if (pmf.size() == 2) return 0;
-    unsigned median = pmf.size() / 2;
-    if (x <= pmf[median]) 
+    });
+    vector<double> mean(dim, 0);
+    for (unsigned t = 0; t < num_threads; t++) 
     {
-        vector<double> pmf_(pmf.cbegin(), pmf.cbegin() + median + 1);
-        return GetInvertalIndex(pmf_, x);
+        for (unsigned d = 0; d < dim; d++) 
+            mean[d] += sums[t * (dim + 1) + d];
     }
-    else 
+    for (unsigned d = 0; d < dim; d++) mean[d] /= n;
+
+    vector<double> distances(n);
+    parallel([&](unsigned t) 
     {
-        vector<double> pmf_(pmf.cbegin() + median, pmf.cend());
-        return GetInvertalIndex(pmf_, x) + median;
-    }
+        unsigned begin = t * chunk, end = std::min(begin + chunk, n);
+        for (unsigned i = begin; i < end; i++) 
+        {
+            double max_diff = 0;
+            for (unsigned d = 0; d < dim; d++) 
+                max_diff = std::max(max_diff, fabs(data[i + d] - mean[d]));
+            distances[i] = max_diff;
+        }
+    });
+    return distances;
 }
 
-pair<vector<vector<Point> >, vector<vector<double> > >
-SampleCoreset(const vector<Point> &points, 
-    unsigned sample_size, unsigned sample_num) 
+void SampenCalculatorCoreset::_Prepare(const vector<int> &data, unsigned m)
 {
-    unsigned n = points.size();
-    // Generate PMF
-    Point mean = ComputeMean(points);
-
-    vector<double> distances(n);
-    for (unsigned i = 0; i < n; i++) 
-        distances[i] = L1Distance(points[i], mean);
+    if (m == prepared_m_ && q_.size() && data == prepared_data_) return;
+    vector<double> distances = ComputeSensitivity(data, m + 1);
+    unsigned n = distances.size();
     double sum = ComputeSum(distances);
-    
-    vector<double> q(n);
-    for (unsigned i = 0; i < n; i++) 
-    {
-        q[i] = 1. / 2 / n + distances[i] / 2 / sum;
-    }
-    vector<double> pmf(n + 1, 0);
-    for (unsigned i = 1; i < n + 1; i++) 
-    {
-        pmf[i] = q[i - 1] + pmf[i -  1];
-        // std::cout << "pmf: " << pmf[i] << std::endl;
-    }    
-
-    // Do sampling.
-    std::random_device rd;
-    std::mt19937 e2(rd());
-    std::uniform_real_distribution<> dist(0, 1);
 
-    vector<vector<Point> > result(sample_num);
-    vector<vector<double> > weights(sample_num);
-    for (unsigned i = 0; i < sample_num; i++)
+    // Half uniform and half proportional to the sensitivities
+    q_.resize(n);
+    for (unsigned i = 0; i < n; i++) 
     {
-        result[i] = vector<Point>(sample_size);
-        weights[i] = vector<double>(sample_size);
-        for (unsigned j = 0; j < sample_size; j++)
-        {
-            double sample = dist(e2);
-            unsigned index = GetInvertalIndex(pmf, sample);
-            result[i][j] = points[index];
-            weights[i][j] = 1. / q[index] / n;
-            // std::cout << "weights: " << weights[i][j] << std::endl;
-        }
+        q_[i] = 1. / 2 / n;
+        if (sum > 0) q_[i] += distances[i] / 2 / sum;
     }
-    return std::make_pair(result, weights);
+    table_ = alias_table(q_);
+    prepared_data_ = data;
+    prepared_m_ = m;
 }
 
 vector<double> SampenCalculatorCoreset::_ComputeAB(
     const vector<int> &data, unsigned m, int r) 
 {
-    vector<Point> points = GetPoints(data, m + 1);
-    auto sampled = SampleCoreset(points, sample_size, sample_num);
-    auto sampled_points = sampled.first;
-    auto weights = sampled.second;
-    
+    _Prepare(data, m);
+    unsigned n = q_.size();
+    unsigned long long seed = GetSeed(random);
+
     vector<double> result(2, 0);
-    ABCalculatorDirectWeighted ABc;
+    ABCalculatorFlatWeighted ABc;
+    vector<unsigned> indices(sample_size);
+    vector<double> weights(sample_size);
     for (unsigned i = 0; i < sample_num; i++) 
     {
-        auto AB = ABc.ComputeAB(sampled_points[i], weights[i], r);
+        // One stream for each round
+        Philox4x32 eng(seed, i);
+        for (unsigned j = 0; j < sample_size; j++)
+        {
+            indices[j] = table_.sample(eng);
+            weights[j] = 1. / q_[indices[j]] / n;
+        }
+        auto AB = ABc.ComputeAB(data, indices, weights, m, r);
         result[0] += AB[0]; 
         result[1] += AB[1];
     }
@@ -351,37 +516,57 @@ double SampenCalculatorCoreset::ComputeSampen(
     return sampen;
 }
 
-vector<long long> SampenCalculatorKDG::_ComputeAB(
-    const vector<int> &data, unsigned m, int r) 
+double SampenCalculatorKDA::ComputeSampen(
+    const vector<int> &data, unsigned m, int r, double *a, double *b)
 {
+    if (!index_ || !index_->Match(data, m))
+        index_ = std::make_shared<SampenIndexKD>(data, m);
 
-    long long A = 0, B = 0;
     unsigned N = data.size();
-
-    int max_ = *std::max_element(data.cbegin(), data.cend());
-    int min_ = *std::min_element(data.cbegin(), data.cend());
-    double diff = static_cast<double>(max_ - min_);
-    unsigned p = static_cast<unsigned>(ceil(log2(diff)));
-    struct kdtree *treem = build_kdtree_grid(data.data(), N - 1, m, p);
-    struct kdtree *treem1 = build_kdtree_grid(data.data(), N, m + 1, p);
-
-    for (unsigned i = 0; i < N - m; i++)
+    unsigned max_nump = std::max((N - m) / 64, 1u);
+    unsigned stride = 32;
+    while (true) 
     {
-        A += count_range_kdtree(treem, data.data() + i, m, r);
-    }
+        double var_a = 0, var_b = 0;
+        vector<double> AB = index_->ComputeABApprox(
+            r, max_nump, stride, &var_a, &var_b);
+        double sampen = ComputeSampenAB(AB[0], AB[1], N, m);
 
-    for (unsigned i = 0; i < N - m; i++)
-    {
-        B += count_range_kdtree(treem1, data.data() + i, m + 1, r);
+        // Relative errors of A and B add up in -log(B / A) 
+        if (AB[0] > 0 && AB[1] > 0) 
+        {
+            error_bound_ = 2 * (sqrt(var_a) / AB[0] + sqrt(var_b) / AB[1]);
+        }
+        else 
+        {
+            error_bound_ = INFINITY;
+        }
+#ifdef DEBUG
+        std::cout << "max_nump: " << max_nump << ", stride: " << stride;
+        std::cout << ", sampen: " << sampen;
+        std::cout << ", error bound: " << error_bound_ << std::endl;
+#endif
+        if (error_bound_ <= rel_err_ * fabs(sampen)) 
+        {
+            if (a) *a = AB[0];
+            if (b) *b = AB[1];
+            return sampen;
+        }
+        // The variance is about inversely proportional to the number of 
+        // exact queries
+        double ratio = error_bound_ / (rel_err_ * fabs(sampen));
+        if (ratio * ratio >= stride / 4.) 
+            break;
+        stride = static_cast<unsigned>(stride / ceil(ratio * ratio));
+        max_nump = std::max(max_nump / 4, 1u);
     }
 
-    A -= (N - m);
-    B -= (N - m);
-
-    vector<long long> result(2);
-    result[0] = A;
-    result[1] = B;
-    return result;
+    // Counting approximately is not cheaper than the exact counting 
+    vector<long long> AB = index_->ComputeAB(r);
+    error_bound_ = 0;
+    if (a) *a = AB[0];
+    if (b) *b = AB[1];
+    return ComputeSampenAB(AB[0], AB[1], N, m);
 }
 
 void CountMatched(const vector<Point> &points, 
@@ -392,6 +577,7 @@ void CountMatched(const vector<Point> &points,
                   vector<long long> &Bs)
 {
     unsigned n = points.size();
+    if (n == 0) return;
     unsigned m = points[0].dim() - 1;
     unsigned index = 0;
     for (unsigned i = 0; (index = i * interval + offset) < n; ++i) 
@@ -410,13 +596,39 @@ void CountMatched(const vector<Point> &points,
     }
 }
 
+// The same as CountMatched, but with the templates in a flat buffer
+void CountMatchedRange(const TemplateBuffer &templates, 
+                       int r, 
+                       unsigned i, 
+                       unsigned begin, 
+                       unsigned end, 
+                       long long *A, 
+                       long long *B)
+{
+    CountMatchedBlocks(templates.coord(0), templates.stride(), 
+                       templates.coord(0) + i, templates.stride(), 
+                       0, templates.dim() - 1, r, begin, end, A, B);
+}
+
+void CountMatchedFlat(const TemplateBuffer &templates, 
+                      int r, 
+                      unsigned offset, 
+                      unsigned interval, 
+                      long long *A, 
+                      long long *B)
+{
+    unsigned n = templates.size();
+    long long a = 0, b = 0;
+    for (unsigned i = offset; i < n; i += interval) 
+        CountMatchedRange(templates, r, i, i + 1, n, &a, &b);
+    *A += a;
+    *B += b;
+}
+
 vector<long long> CountMatchedPara(const vector<Point> &points, int r) 
 {
     unsigned n = points.size();
-    unsigned num_threads = std::thread::hardware_concurrency();
-    if (!num_threads) num_threads = 16;
-    else if (num_threads > 12) num_threads -= 8;
-    else num_threads /= 2;
+    unsigned num_threads = GetNumThreads();
 
     vector<long long> As(num_threads, 0), Bs(num_threads, 0);
     if (num_threads > n) num_threads = n / 2;
@@ -438,6 +650,456 @@ vector<long long> CountMatchedPara(const vector<Point> &points, int r)
 }
 
 
+// The rounds are spread over the threads, and each round is counted by one 
+// thread, unless the samples are large and the rounds are too few to keep 
+// all threads busy. The sampled indices are sorted for locality before the 
+// templates are gathered, and the buffers are reused by the rounds.
+void SampenCalculatorSampling::_ComputeRounds(
+    const vector<int> &data, unsigned m, int r, 
+    unsigned begin, unsigned end, vector<long long> &ABs) 
+{
+    unsigned num_rounds = end - begin;
+    unsigned num_threads = std::min(GetNumThreads(), num_rounds);
+    const unsigned kMaxSizeSerial = 4096;
+    if (num_threads <= 1 || 
+        (num_rounds < GetNumThreads() && sample_size > kMaxSizeSerial))
+    {
+        ABCalculatorFlatD ABc;
+        vector<unsigned> indices(sample_size);
+        TemplateBuffer sampled;
+        for (unsigned i = begin; i < end; i++)
+        {
+            _Sample(i, indices);
+            std::sort(indices.begin(), indices.end());
+            sampled.Gather(data, indices, m + 1);
+            vector<long long> AB = ABc.ComputeAB(sampled, r);
+            ABs[2 * i] = AB[0];
+            ABs[2 * i + 1] = AB[1];
+            if (controls_) 
+            {
+                CountGridMatched(grid_cells_, data.size(), indices, m, 
+                                 &(*controls_)[2 * i], 
+                                 &(*controls_)[2 * i + 1]);
+            }
+        }
+    }
+    else 
+    {
+        auto run = [&](unsigned offset) 
+        {
+            vector<unsigned> indices(sample_size);
+            TemplateBuffer sampled;
+            for (unsigned i = begin + offset; i < end; i += num_threads)
+            {
+                _Sample(i, indices);
+                std::sort(indices.begin(), indices.end());
+                sampled.Gather(data, indices, m + 1);
+                long long A = 0, B = 0;
+                CountMatchedFlat(sampled, r, 0, 1, &A, &B);
+                ABs[2 * i] = A;
+                ABs[2 * i + 1] = B;
+                if (controls_) 
+                {
+                    CountGridMatched(grid_cells_, data.size(), indices, m, 
+                                     &(*controls_)[2 * i], 
+                                     &(*controls_)[2 * i + 1]);
+                }
+            }
+        };
+        vector<std::thread> threads;
+        for (unsigned i = 0; i < num_threads; i++)
+            threads.push_back(std::thread(run, i));
+        for (unsigned i = 0; i < num_threads; i++)
+            threads[i].join();
+    }
+#ifdef DEBUG 
+    double normalizer = pow(sample_size - 1., 2.); 
+    for (unsigned i = begin; i < end; i++)
+    {
+        std::cout << "A: " << ABs[2 * i] << " ("; 
+        std::cout << static_cast<double>(ABs[2 * i]) / normalizer << ")\n";
+        std::cout << "B: " << ABs[2 * i + 1] << " ("; 
+        std::cout << static_cast<double>(ABs[2 * i + 1]) / normalizer;
+        std::cout << ")\n";
+    }
+#endif 
+}
+
+void SampenCalculatorSampling::_RunRounds(
+    unsigned begin, unsigned end, const std::function<void(unsigned)> &round)
+{
+    if (begin >= end) return;
+    unsigned num_threads = std::min(GetNumThreads(), end - begin);
+    auto run = [&](unsigned offset) 
+    {
+        for (unsigned i = begin + offset; i < end; i += num_threads)
+            round(i);
+    };
+    if (num_threads <= 1) 
+    {
+        run(0);
+        return;
+    }
+    vector<std::thread> threads;
+    for (unsigned i = 0; i < num_threads; i++)
+        threads.push_back(std::thread(run, i));
+    for (unsigned i = 0; i < num_threads; i++)
+        threads[i].join();
+}
+
+vector<long long> SampenCalculatorSampling::_ComputeAB(
+    const vector<int> &data, unsigned m, int r) 
+{
+    _Prepare(data, m);
+    vector<long long> ABs(2 * sample_num, 0);
+    _ComputeRounds(data, m, r, 0, sample_num, ABs);
+    return ABs;
+}
+
+// The quantile function of the standard normal distribution
+double NormalQuantile(double p)
+{
+    double lower = -10, upper = 10;
+    for (unsigned i = 0; i < 64; i++)
+    {
+        double mid = (lower + upper) / 2;
+        if (0.5 * erfc(-mid / sqrt(2.)) < p) lower = mid;
+        else upper = mid;
+    }
+    return (lower + upper) / 2;
+}
+
+double ComputeSampenVariance(const vector<long long> &AB)
+{
+    return ComputeSampenVariance(vector<double>(AB.cbegin(), AB.cend()));
+}
+
+double ComputeSampenVariance(const vector<double> &AB)
+{
+    unsigned k = AB.size() / 2;
+    if (k < 2) return INFINITY;
+    double mean_a = 0, mean_b = 0;
+    for (unsigned i = 0; i < k; i++)
+    {
+        mean_a += AB[2 * i];
+        mean_b += AB[2 * i + 1];
+    }
+    mean_a /= k;
+    mean_b /= k;
+    if (mean_a <= 0 || mean_b <= 0) return INFINITY;
+
+    double var_a = 0, var_b = 0, cov_ab = 0;
+    for (unsigned i = 0; i < k; i++)
+    {
+        double da = AB[2 * i] - mean_a, db = AB[2 * i + 1] - mean_b;
+        var_a += da * da;
+        var_b += db * db;
+        cov_ab += da * db;
+    }
+    var_a /= k - 1;
+    var_b /= k - 1;
+    cov_ab /= k - 1;
+    // -log(B / A) = log(A) - log(B)
+    double var = var_a / (mean_a * mean_a) + var_b / (mean_b * mean_b) - 
+        2 * cov_ab / (mean_a * mean_b);
+    return std::max(var, 0.) / k;
+}
+
+SampenEstimate SampenCalculatorSampling::ComputeEstimate(
+    const vector<int> &data, unsigned m, int r)
+{
+    _CheckDim(data, m);
+    vector<long long> AB = _ComputeAB(data, m, r);
+    unsigned rounds = AB.size() / 2;
+    long long A = 0, B = 0;
+    for (unsigned i = 0; i < rounds; i++)
+    {
+        A += AB[2 * i];
+        B += AB[2 * i + 1];
+    }
+
+    SampenEstimate estimate;
+    estimate.sampen = ComputeSampenAB(A, B, data.size(), m);
+    estimate.a = static_cast<double>(A) / rounds;
+    estimate.b = static_cast<double>(B) / rounds;
+    estimate.variance = ComputeSampenVariance(AB);
+    estimate.std_error = sqrt(estimate.variance);
+    estimate.rounds = rounds;
+    return estimate;
+}
+
+SampenEstimate SampenCalculatorSampling::ComputeEstimateCV(
+    const vector<int> &data, unsigned m, int r)
+{
+    _CheckDim(data, m);
+    const unsigned n = data.size() - m;
+    if (std::isnan(_ControlMean(0, n)))
+        throw std::invalid_argument(
+            "control variates are not supported by this sampling");
+    grid_cells_ = ComputeGridCells(data, r, kControlGrids);
+    vector<unsigned> indices(n);
+    for (unsigned i = 0; i < n; i++) indices[i] = i;
+    long long matched_m = 0, matched_m1 = 0;
+    CountGridMatched(grid_cells_, data.size(), indices, m, 
+                     &matched_m, &matched_m1);
+    const double mean_m = _ControlMean(matched_m, n);
+    const double mean_m1 = _ControlMean(matched_m1, n);
+
+    vector<long long> controls(2 * sample_num, 0);
+    controls_ = &controls;
+    vector<long long> AB;
+    try 
+    {
+        AB = _ComputeAB(data, m, r);
+    }
+    catch (...) 
+    {
+        controls_ = nullptr;
+        grid_cells_.clear();
+        throw;
+    }
+    controls_ = nullptr;
+    grid_cells_.clear();
+
+    // The control C = C_m / E[C_m] - C_m1 / E[C_m1] is the linearized 
+    // log-ratio of the grid matches, whose mean is exactly 0. A cell that 
+    // no pair shares is never shared in the rounds either.
+    const unsigned rounds = sample_num;
+    vector<double> c(rounds, 0);
+    double mean_a = 0, mean_b = 0, mean = 0;
+    for (unsigned i = 0; i < rounds; i++)
+    {
+        if (mean_m > 0) c[i] += controls[2 * i] / mean_m;
+        if (mean_m1 > 0) c[i] -= controls[2 * i + 1] / mean_m1;
+        mean_a += AB[2 * i];
+        mean_b += AB[2 * i + 1];
+        mean += c[i];
+    }
+    mean_a /= rounds;
+    mean_b /= rounds;
+    mean /= rounds;
+    SampenEstimate estimate;
+    estimate.rounds = rounds;
+    if (mean_a <= 0 || mean_b <= 0)
+    {
+        estimate.sampen = ComputeSampenAB(mean_a, mean_b, data.size(), m);
+        estimate.a = mean_a;
+        estimate.b = mean_b;
+        estimate.variance = INFINITY;
+        estimate.std_error = INFINITY;
+        return estimate;
+    }
+
+    // The slopes of A, B and the linearized sampen Z = A / mean_a - 
+    // B / mean_b on C over the rounds, 0 if C does not vary
+    vector<double> z(rounds);
+    double var_c = 0, cov_a = 0, cov_b = 0, cov_z = 0;
+    for (unsigned i = 0; i < rounds; i++)
+    {
+        double dc = c[i] - mean;
+        z[i] = AB[2 * i] / mean_a - AB[2 * i + 1] / mean_b;
+        var_c += dc * dc;
+        cov_a += (AB[2 * i] - mean_a) * dc;
+        cov_b += (AB[2 * i + 1] - mean_b) * dc;
+        cov_z += z[i] * dc;
+    }
+    const double beta_a = var_c > 0 ? cov_a / var_c : 0;
+    const double beta_b = var_c > 0 ? cov_b / var_c : 0;
+    const double beta_z = var_c > 0 ? cov_z / var_c : 0;
+
+    // The slope of Z is the optimal one for sampen, which is corrected as a 
+    // whole; A and B are corrected separately for the report
+    estimate.sampen = log(mean_a / mean_b) - beta_z * mean;
+    estimate.a = mean_a - beta_a * mean;
+    estimate.b = mean_b - beta_b * mean;
+    estimate.variance = INFINITY;
+    if (rounds > 2)
+    {
+        double var_z = 0;
+        for (unsigned i = 0; i < rounds; i++)
+        {
+            double e = z[i] - beta_z * (c[i] - mean);
+            var_z += e * e;
+        }
+        estimate.variance = var_z / (rounds - 2) / rounds;
+    }
+    estimate.std_error = sqrt(estimate.variance);
+    return estimate;
+}
+
+vector<SampenEstimate> SampenCalculatorSampling::ComputeSweep(
+    const vector<int> &data, unsigned m, int r, 
+    const vector<unsigned> &sample_sizes)
+{
+    _CheckDim(data, m);
+    if (!_Nested())
+        throw std::invalid_argument("the samples are not nested");
+    if (sample_sizes.empty()) return vector<SampenEstimate>();
+    for (unsigned c = 1; c < sample_sizes.size(); c++)
+    {
+        if (sample_sizes[c] < sample_sizes[c - 1])
+            throw std::invalid_argument("sample_sizes should be increasing");
+    }
+    RestoreOnExit<unsigned> restore(sample_size);
+    const unsigned num_sizes = sample_sizes.size();
+    sample_size = sample_sizes.back();
+    _Prepare(data, m);
+
+    // AB[c][2 * i], AB[c][2 * i + 1]: A and B of round i at the c-th size
+    vector<vector<long long> > AB(num_sizes, 
+                                  vector<long long>(2 * sample_num, 0));
+    // The rounds run one after another, and the pairs (j, k), j < k, of a 
+    // round are split over the threads by k, since later k have more pairs
+    vector<unsigned> indices(sample_size);
+    TemplateBuffer sampled;
+    const unsigned num_threads = std::max(
+        std::min(GetNumThreads(), sample_size / 256), 1u);
+    for (unsigned i = 0; i < sample_num; i++)
+    {
+        _Sample(i, indices);
+        sampled.Gather(data, indices, m + 1);
+        vector<vector<long long> > counts(
+            num_threads, vector<long long>(2 * num_sizes, 0));
+        auto run = [&](unsigned t) 
+        {
+            unsigned c = 0;
+            for (unsigned k = t; k < sample_size; k += num_threads)
+            {
+                // The pairs with k are first sampled at the c-th size
+                while (k >= sample_sizes[c]) c++;
+                CountMatchedRange(sampled, r, k, 0, k, 
+                                  &counts[t][2 * c], &counts[t][2 * c + 1]);
+            }
+        };
+        vector<std::thread> threads;
+        for (unsigned t = 1; t < num_threads; t++)
+            threads.push_back(std::thread(run, t));
+        run(0);
+        for (auto &thread : threads) thread.join();
+        long long A = 0, B = 0;
+        for (unsigned c = 0; c < num_sizes; c++)
+        {
+            for (unsigned t = 0; t < num_threads; t++)
+            {
+                A += counts[t][2 * c];
+                B += counts[t][2 * c + 1];
+            }
+            AB[c][2 * i] = A;
+            AB[c][2 * i + 1] = B;
+        }
+    }
+
+    vector<SampenEstimate> estimates(num_sizes);
+    for (unsigned c = 0; c < num_sizes; c++)
+    {
+        long long A = 0, B = 0;
+        for (unsigned i = 0; i < sample_num; i++)
+        {
+            A += AB[c][2 * i];
+            B += AB[c][2 * i + 1];
+        }
+        SampenEstimate &estimate = estimates[c];
+        estimate.sampen = ComputeSampenAB(A, B, data.size(), m);
+        estimate.a = static_cast<double>(A) / sample_num;
+        estimate.b = static_cast<double>(B) / sample_num;
+        estimate.variance = ComputeSampenVariance(AB[c]);
+        estimate.std_error = sqrt(estimate.variance);
+        estimate.rounds = sample_num;
+    }
+    return estimates;
+}
+
+double SampenCalculatorSampling::ComputeEntropySequential(
+    const vector<int> &data, unsigned m, int r, double rel_err, 
+    double confidence, unsigned max_rounds, SequentialReport *report)
+{
+    _CheckDim(data, m);
+    if (confidence <= 0 || confidence >= 1)
+        throw std::invalid_argument("confidence should be in (0, 1)");
+    if (sample_size == 0)
+        throw std::invalid_argument("sample_size should be positive");
+    if (max_rounds == 0)
+        throw std::invalid_argument("max_rounds should be positive");
+    const double z = NormalQuantile(0.5 + confidence / 2);
+    const unsigned batch = std::max(GetNumThreads(), 4u);
+    const unsigned N = data.size();
+    RestoreOnExit<unsigned> restore(sample_size);
+
+    _Prepare(data, m);
+    vector<long long> ABs;
+    unsigned rounds = 0, total_rounds = 0;
+    long long A = 0, B = 0;
+    double sampen = NAN, half = INFINITY;
+    bool converged = false;
+    while (total_rounds < max_rounds)
+    {
+        unsigned end = rounds + std::min(batch, max_rounds - total_rounds);
+        ABs.resize(2 * end);
+        _ComputeRounds(data, m, r, rounds, end, ABs);
+        total_rounds += end - rounds;
+        rounds = end;
+
+        A = B = 0;
+        for (unsigned i = 0; i < rounds; i++)
+        {
+            A += ABs[2 * i];
+            B += ABs[2 * i + 1];
+        }
+        if (B == 0 && 2 * sample_size <= N - m && total_rounds < max_rounds)
+        {
+            // Too few matches to estimate the ratio
+            sample_size *= 2;
+            _Prepare(data, m);
+            rounds = 0;
+            continue;
+        }
+        sampen = ComputeSampenAB(A, B, N, m);
+        half = z * sqrt(ComputeSampenVariance(ABs));
+#ifdef DEBUG
+        std::cout << "rounds: " << rounds << ", sampen: " << sampen;
+        std::cout << ", half width: " << half << std::endl;
+#endif
+        // The interval is meaningless without matches of length m + 1
+        converged = B > 0 && half <= rel_err * fabs(sampen);
+        if (converged) break;
+    }
+
+    if (report) 
+    {
+        report->rounds = rounds;
+        report->sample_size = sample_size;
+        report->a = rounds ? static_cast<double>(A) / rounds : 0;
+        report->b = rounds ? static_cast<double>(B) / rounds : 0;
+        report->lower = sampen - half;
+        report->upper = sampen + half;
+        report->converged = converged;
+    }
+    return sampen;
+}
+
+vector<long long> ABCalculatorFlatD::ComputeAB(
+    const TemplateBuffer &templates, int r)
+{
+    unsigned n = templates.size();
+    unsigned num_threads = std::min(GetNumThreads(), n / 2);
+    vector<long long> As(num_threads, 0), Bs(num_threads, 0);
+    vector<std::thread> threads;
+    for (unsigned i = 0; i < num_threads; i++) 
+    {
+        threads.push_back(
+            std::thread(CountMatchedFlat, std::cref(templates), r, 
+                        i, num_threads, &As[i], &Bs[i]));
+    }
+    for (unsigned i = 0; i < num_threads; i++) 
+    {
+        threads[i].join();
+    }
+    vector<long long> AB(2);
+    AB[0] = std::accumulate(As.cbegin(), As.cend(), static_cast<long long>(0));
+    AB[1] = std::accumulate(Bs.cbegin(), Bs.cend(), static_cast<long long>(0));
+    return AB;
+}
+
 // Compute A and B with points using direct method
 // TODO: this part can be parallelized
 vector<long long> ABCalculatorPointD::ComputeAB(
@@ -476,20 +1138,7 @@ long long CountPointsRT(const vector<Point> &points,
 {
     /* build tree */
     RT::RangeTree<int, int> rtree(points);
-    vector<int> lower(m, 0), upper(m, 0);
-
-    /* counting */
-    long long result = 0;
-    for (vector<int>::size_type i = 0; i < points.size(); i++)
-    {
-        for (unsigned j = 0; j < m; j++)
-        {
-            lower[j] = points[i][j] - r;
-            upper[j] = points[i][j] + r;
-        }
-        result += rtree.countInRange(lower, upper);
-    }
-    return result;
+    return CountPointsRT(rtree, points, m, r);
 }
 
 vector<long long> ABCalculatorPointRT::ComputeAB(
@@ -542,6 +1191,86 @@ vector<double> ABCalculatorDirectWeighted::ComputeAB(
     return result;
 } 
 
+// The same as CountMatchedFlat, but each matched pair adds the product of 
+// the weights of the templates
+void CountMatchedFlatWeighted(const TemplateBuffer &templates, 
+                              const double *weights, 
+                              int r, 
+                              unsigned offset, 
+                              unsigned interval, 
+                              double *A, 
+                              double *B)
+{
+    unsigned n = templates.size();
+    if (n == 0) return;
+    double a = 0, b = 0;
+    for (unsigned i = offset; i < n; i += interval) 
+    {
+        double weight_a = 0, weight_b = 0;
+        CountMatchedBlocks(templates.coord(0), templates.stride(), 
+                           templates.coord(0) + i, templates.stride(), 
+                           0, templates.dim() - 1, r, i + 1, n, 
+                           &weight_a, &weight_b, weights);
+        a += weights[i] * weight_a;
+        b += weights[i] * weight_b;
+    }
+    *A += a;
+    *B += b;
+}
+
+vector<double> ABCalculatorFlatWeighted::ComputeAB(
+    const vector<int> &data, const vector<unsigned> &indices, 
+    const vector<double> &weights, unsigned m, int r)
+{
+    if (indices.size() != weights.size()) 
+        throw std::invalid_argument("indices.size() != weights.size()");
+
+    // Collapse the duplicates, the pairs among the duplicates of a 
+    // template always match and add (W^2 - sum of w^2) / 2
+    vector<std::pair<unsigned, double> > sampled(indices.size());
+    for (unsigned j = 0; j < indices.size(); j++) 
+        sampled[j] = std::make_pair(indices[j], weights[j]);
+    std::sort(sampled.begin(), sampled.end());
+    vector<unsigned> unique;
+    vector<double, aligned_allocator<double, 64> > summed;
+    double self = 0;
+    for (unsigned j = 0; j < sampled.size(); ) 
+    {
+        unsigned k = j;
+        double sum = 0, sum2 = 0;
+        for (; k < sampled.size() && sampled[k].first == sampled[j].first; k++) 
+        {
+            sum += sampled[k].second;
+            sum2 += sampled[k].second * sampled[k].second;
+        }
+        unique.push_back(sampled[j].first);
+        summed.push_back(sum);
+        self += (sum * sum - sum2) / 2;
+        j = k;
+    }
+    TemplateBuffer templates;
+    templates.Gather(data, unique, m + 1);
+
+    unsigned n = unique.size();
+    unsigned num_threads = std::max(std::min(GetNumThreads(), n / 2), 1u);
+    vector<double> As(num_threads, 0), Bs(num_threads, 0);
+    vector<std::thread> threads;
+    for (unsigned i = 1; i < num_threads; i++) 
+    {
+        threads.push_back(
+            std::thread(CountMatchedFlatWeighted, std::cref(templates), 
+                        summed.data(), r, i, num_threads, &As[i], &Bs[i]));
+    }
+    CountMatchedFlatWeighted(templates, summed.data(), r, 0, num_threads, 
+                             &As[0], &Bs[0]);
+    for (auto &thread : threads) thread.join();
+
+    vector<double> result(2, self);
+    result[0] += std::accumulate(As.cbegin(), As.cend(), 0.);
+    result[1] += std::accumulate(Bs.cbegin(), Bs.cend(), 0.);
+    return result;
+}
+
 double ComputeSampenDirect(
     const vector<int> &data, unsigned m, int r, 
     double *a, double *b)
@@ -566,6 +1295,24 @@ double ComputeSampenKdtree(
     return sc.ComputeEntropy(data, m, r, a, b);
 }
 
+double ComputeSampenWidetree(
+    const vector<int> &data, unsigned m, int r, 
+    double *a, double *b)
+{
+    SampenCalculatorWT sc;
+    return sc.ComputeEntropy(data, m, r, a, b);
+}
+
+double ComputeSampenKdtreeApprox(
+    const vector<int> &data, unsigned m, int r, double rel_err, 
+    double *a, double *b, double *error_bound)
+{
+    SampenCalculatorKDA sc(rel_err);
+    double result = sc.ComputeSampen(data, m, r, a, b);
+    if (error_bound) *error_bound = sc.error_bound();
+    return result;
+}
+
 double ComputeSampenNkdtreeHist(
     const vector<int> &data, unsigned m, int r, 
     unsigned sample_size, unsigned sample_num, 
@@ -601,6 +1348,30 @@ double ComputeSampenQR2(
     return sc.ComputeEntropy(data, m, r, a, b);
 }
 
+vector<SampenEstimate> ComputeSampenQRSweep(
+    const vector<int> &data, unsigned m, int r, 
+    const vector<unsigned> &sample_sizes, unsigned sample_num, bool presort)
+{
+    SampenCalculatorQR sc(sample_num, 0, presort);
+    return sc.ComputeSweep(data, m, r, sample_sizes);
+}
+
+double ComputeSampenPair(
+    const vector<int> &data, unsigned m, int r, 
+    unsigned sample_size, unsigned sample_num, double *a, double *b)
+{
+    SampenCalculatorPair sc(sample_num, sample_size);
+    return sc.ComputeEntropy(data, m, r, a, b);
+}
+
+double ComputeSampenQuery(
+    const vector<int> &data, unsigned m, int r, 
+    unsigned sample_size, unsigned sample_num, double *a, double *b)
+{
+    SampenCalculatorQuery sc(sample_num, sample_size);
+    return sc.ComputeEntropy(data, m, r, a, b);
+}
+
 double ComputeSampenCoreset(
     const vector<int> &data, unsigned m, int r, 
     unsigned sample_size, unsigned sample_num, double *a, double *b)
@@ -12,12 +12,14 @@
 #include <vector>
 #include <math.h>
 #include <chrono>
+#include <functional>
 
 #include "random_sampler.h"
+#include "sampen_index.h"
 
 using std::vector;
 
-double ComputeSampenAB(double A, double B, unsigned N, unsigned m)
+inline double ComputeSampenAB(double A, double B, unsigned N, unsigned m)
 {
     // std::cout << "A: " << A << ", B: " << B << std::endl;
     if (A > 0 && B > 0)
@@ -29,15 +31,25 @@ double ComputeSampenAB(double A, double B, unsigned N, unsigned m)
         return -log((N - m - 1) / (N - m));
 }
 
+/*
+ * Variance of -log(B / A) estimated from the per-round A and B by the delta 
+ * method, where A and B are the sums over the rounds.
+ *
+ * @param AB: A and B of the rounds, i.e., A_0, B_0, A_1, B_1, ...
+ */
+double ComputeSampenVariance(const vector<long long> &AB);
+double ComputeSampenVariance(const vector<double> &AB);
+
 // base class to calculate sample entropy
 class SampenCalculator
 {
-private:
+protected:
     void _CheckDim(const vector<int> &data, unsigned m)
     {
         if (data.size() <= m)
             throw std::invalid_argument("data.size() < m");
     }
+private:
     virtual vector<long long> _ComputeAB(
         const vector<int> &data, unsigned m, int r) = 0;
 
@@ -72,7 +84,7 @@ public:
     }
 };
 
-// direct method
+// direct method; the identical templates are counted by hashing for r = 0
 class SampenCalculatorD : public SampenCalculator
 {
 private:
@@ -80,36 +92,112 @@ private:
         const vector<int> &data, unsigned m, int r) override;
 };
 
-// range tree
-class SampenCalculatorRT : public SampenCalculator
+// base class of the calculators using an index, which is built once for 
+// each (data, m) and reused by the following calls with other r
+class SampenCalculatorIndexed : public SampenCalculator
 {
+public:
+    // Build the index for data and m, or return the cached one
+    shared_ptr<const SampenIndex> BuildIndex(const vector<int> &data, 
+                                             unsigned m)
+    {
+        if (!index_ || !index_->Match(data, m))
+            index_ = _BuildIndex(data, m);
+        return index_;
+    }
+    void set_index(shared_ptr<const SampenIndex> index) { index_ = index; }
 private:
+    virtual shared_ptr<const SampenIndex> _BuildIndex(
+        const vector<int> &data, unsigned m) = 0;
     virtual vector<long long> _ComputeAB(
-        const vector<int> &data, unsigned m, int r) override;
+        const vector<int> &data, unsigned m, int r) override
+    {
+        return BuildIndex(data, m)->ComputeAB(r);
+    }
+    shared_ptr<const SampenIndex> index_;
+};
+
+// range tree
+class SampenCalculatorRT : public SampenCalculatorIndexed
+{
+private:
+    virtual shared_ptr<const SampenIndex> _BuildIndex(
+        const vector<int> &data, unsigned m) override
+    {
+        return std::make_shared<SampenIndexRT>(data, m);
+    }
 };
 
 // old kd tree
-class SampenCalculatorKD: public SampenCalculator
+class SampenCalculatorKD: public SampenCalculatorIndexed
 {
 private:
-    virtual vector<long long> _ComputeAB(
-        const vector<int> &data, unsigned m, int r) override;
+    virtual shared_ptr<const SampenIndex> _BuildIndex(
+        const vector<int> &data, unsigned m) override
+    {
+        return std::make_shared<SampenIndexKD>(data, m);
+    }
 };
 
 // Compute sample entropy by kd tree divided according to grid
-class SampenCalculatorKDG: public SampenCalculator
+class SampenCalculatorKDG: public SampenCalculatorIndexed
 {
 private:
-    virtual vector<long long> _ComputeAB(
-        const vector<int> &data, unsigned m, int r) override;
+    virtual shared_ptr<const SampenIndex> _BuildIndex(
+        const vector<int> &data, unsigned m) override
+    {
+        return std::make_shared<SampenIndexKDG>(data, m);
+    }
 };
 
-// Uniform distribution sampling
-class SampenCalculatorUniform: public SampenCalculator
+// Compute sample entropy by the wide bounding volume tree
+class SampenCalculatorWT: public SampenCalculatorIndexed
+{
+private:
+    virtual shared_ptr<const SampenIndex> _BuildIndex(
+        const vector<int> &data, unsigned m) override
+    {
+        return std::make_shared<SampenIndexWT>(data, m);
+    }
+};
+
+// Sample entropy estimated by sampling together with its precision
+struct SampenEstimate
+{
+    double sampen;
+    // A and B averaged over the rounds
+    double a;
+    double b;
+    // The variance and the standard error of sampen by the delta method
+    double variance;
+    double std_error;
+    unsigned rounds;
+};
+
+// Report of the sequential estimation of sample entropy
+struct SequentialReport
+{
+    // The number of rounds and the sample size used
+    unsigned rounds;
+    unsigned sample_size;
+    // A and B averaged over the rounds
+    double a;
+    double b;
+    // The confidence interval of sample entropy
+    double lower;
+    double upper;
+    // Whether the target error is reached within the cost cap
+    bool converged;
+};
+
+// base class of the calculators which sample the templates sample_num times.
+// The rounds are independent from each other and run concurrently, so 
+// that the result does not depend on the number of threads.
+class SampenCalculatorSampling : public SampenCalculator
 {
 public:
-    explicit SampenCalculatorUniform(
-        unsigned sample_num_, unsigned sample_size_, bool random_ = false)
+    SampenCalculatorSampling(
+        unsigned sample_num_, unsigned sample_size_, bool random_)
         : sample_num(sample_num_), sample_size(sample_size_), 
         real_random(random_) 
     {}
@@ -118,46 +206,208 @@ public:
     {
         sample_size = sample_size_;
     }
+    // Compute sample entropy and its standard error from the spread of the 
+    // rounds, the standard error is infinite with fewer than two rounds
+    SampenEstimate ComputeEstimate(const vector<int> &data, unsigned m, int r);
+    /*
+     * Add rounds until the confidence interval of sample entropy is within 
+     * rel_err * sampen, or max_rounds rounds have been computed. The sample 
+     * size is doubled if the rounds find no matches of length m + 1 and the 
+     * budget of rounds is not used up, otherwise the estimate of the last 
+     * rounds is returned with report->converged false.
+     *
+     * @param confidence: the confidence level of the interval, e.g., 0.95
+     * @param report: the rounds used and the interval reached
+     */
+    double ComputeEntropySequential(
+        const vector<int> &data, unsigned m, int r, double rel_err, 
+        double confidence, unsigned max_rounds, SequentialReport *report);
+    /*
+     * The same as ComputeEstimate with a control variate: the sampled 
+     * pairs sharing a cell of each of eight shifted grids of width 2r + 1 are 
+     * counted in each round on m and m + 1 coordinates, C_m and C_m1, and 
+     * sampen, A and B are corrected by beta C with C = C_m / E[C_m] - 
+     * C_m1 / E[C_m1], the linearized log-ratio of the grid matches, and the 
+     * optimal beta of each estimated from the rounds, so that the standard 
+     * error needs at least three rounds. E[C_m] and E[C_m1] are known 
+     * exactly from the cells of all templates, which are counted by 
+     * hashing. The sampled templates are assumed independent and uniform, 
+     * which is exact for SampenCalculatorUniform and SampenCalculatorPair. 
+     * Other calculators throw std::invalid_argument.
+     */
+    SampenEstimate ComputeEstimateCV(const vector<int> &data, unsigned m, 
+                                     int r);
+    /*
+     * The estimates for each of the increasing sample sizes, which are the 
+     * same as those of ComputeEstimate with that sample size. The sample of 
+     * a smaller size is a prefix of that of a larger one, so one sample of 
+     * the largest size is grown and only the pairs with the new templates 
+     * are counted, which costs as much as the largest size alone. It is 
+     * supported by SampenCalculatorUniform and SampenCalculatorQR, and the 
+     * other calculators throw std::invalid_argument.
+     */
+    vector<SampenEstimate> ComputeSweep(const vector<int> &data, unsigned m, 
+                                        int r, 
+                                        const vector<unsigned> &sample_sizes);
+
+protected:
+    // Run round(i) for begin <= i < end, with the rounds spread over the 
+    // threads
+    static void _RunRounds(unsigned begin, unsigned end, 
+                           const std::function<void(unsigned)> &round);
+    unsigned sample_num;
+    unsigned sample_size;
+    bool real_random;
+    // The grid matches C_m and C_m1 of each round, which are counted by 
+    // _ComputeRounds into controls_[2 * i], controls_[2 * i + 1] when it is 
+    // not nullptr
+    vector<long long> *controls_ = nullptr;
+    // The cell of each value in each of the shifted grids of the control 
+    // variate, filled by ComputeEstimateCV for _ComputeRounds
+    vector<int> grid_cells_;
+    static const unsigned kControlGrids = 8;
 
 private:
+    // The expected grid matches of a round, where matched is the number of 
+    // pairs i < j of the n templates sharing a cell, summed over the grids, 
+    // or NAN if the sampling is not supported
+    virtual double _ControlMean(long long /* matched */, 
+                                unsigned /* n */) const 
+    {
+        return NAN;
+    }
+    // Whether the sample of a round is a prefix of the sample of the same 
+    // round with a larger sample size
+    virtual bool _Nested() const { return false; }
+    // Compute the rounds [begin, end) into AB[2 * begin], ..., AB[2 * end - 1]
+    virtual void _ComputeRounds(
+        const vector<int> &data, unsigned m, int r, 
+        unsigned begin, unsigned end, vector<long long> &AB);
+    // Compute the state shared by all rounds
+    virtual void _Prepare(const vector<int> &data, unsigned m) = 0;
+    // Draw the indices of the templates sampled in the i-th round, which 
+    // may be called concurrently
+    virtual void _Sample(unsigned i, vector<unsigned> &indices) const = 0;
     virtual vector<long long> _ComputeAB(const vector<int> &data,
                                          unsigned m, int r) override;
-    unsigned sample_num;
-    unsigned sample_size;
-    bool real_random;
+};
+
+// Uniform distribution sampling
+class SampenCalculatorUniform: public SampenCalculatorSampling
+{
+public:
+    explicit SampenCalculatorUniform(
+        unsigned sample_num_, unsigned sample_size_, bool random_ = false)
+        : SampenCalculatorSampling(sample_num_, sample_size_, random_)
+    {}
+
+private:
+    virtual void _Prepare(const vector<int> &data, unsigned m) override;
+    virtual void _Sample(
+        unsigned i, vector<unsigned> &indices) const override;
+    virtual double _ControlMean(long long matched, unsigned n) const override;
+    virtual bool _Nested() const override { return true; }
+    // The number of templates
+    unsigned n_;
 };
 
 // quasi-random sampling
-class SampenCalculatorQR: public SampenCalculator
+class SampenCalculatorQR: public SampenCalculatorSampling
 {
 public: 
     explicit SampenCalculatorQR(unsigned sample_num_, unsigned sample_size_, 
                                 bool presort = true, bool _random = false) 
-        : sample_num(sample_num_), sample_size(sample_size_), 
-        real_random(_random), presort(presort)
+        : SampenCalculatorSampling(sample_num_, sample_size_, _random), 
+        presort(presort), sorted_m_(0), sorted_(false)
     {}
-    void set_sample_num(unsigned sample_num_) { sample_num = sample_num_; }
-    void set_sample_size(unsigned sample_size_)
-    {
-        sample_size = sample_size_;
-    }
 
 private:
-    virtual vector<long long> _ComputeAB(const vector<int> &data,
-                                         unsigned m, int r) override;
-    unsigned sample_num;
-    unsigned sample_size;
-    bool real_random;
+    virtual void _Prepare(const vector<int> &data, unsigned m) override;
+    virtual void _Sample(
+        unsigned i, vector<unsigned> &indices) const override;
+    // The points of the Sobol sequence and the offsets do not depend on the 
+    // sample size
+    virtual bool _Nested() const override { return true; }
     bool presort;
+    // Templates in the sorted order when presort is set, which is cached 
+    // for the record sorted_data_ and sorted_m_
+    vector<unsigned> order_;
+    vector<int> sorted_data_;
+    unsigned sorted_m_;
+    bool sorted_;
+    // Indices of the first round, the others are shifted by random offsets
+    vector<unsigned> indices_;
 };
 
 
+// Sample pairs of templates instead of templates, sample_size is the number 
+// of pairs of each round. The pairs are uniform over i < j, so that the 
+// numbers of matched pairs are unbiased estimates of the probabilities of 
+// matching, and the cost is linear in the number of pairs.
+class SampenCalculatorPair: public SampenCalculatorSampling
+{
+public:
+    /*
+     * @param quasi: draw the pairs from the 2-D Sobol sequence, with a 
+     *   random shift for each round but the first one
+     */
+    explicit SampenCalculatorPair(unsigned sample_num_, unsigned sample_size_, 
+                                  bool quasi = true, bool random_ = false)
+        : SampenCalculatorSampling(sample_num_, sample_size_, random_), 
+        quasi(quasi)
+    {}
+
+private:
+    virtual void _ComputeRounds(
+        const vector<int> &data, unsigned m, int r, 
+        unsigned begin, unsigned end, vector<long long> &AB) override;
+    virtual void _Prepare(const vector<int> &data, unsigned m) override;
+    // Draw the pairs of the i-th round into indices[2 * k], indices[2 * k + 1]
+    virtual void _Sample(
+        unsigned i, vector<unsigned> &indices) const override;
+    virtual double _ControlMean(long long matched, unsigned n) const override;
+    bool quasi;
+    // The number of templates
+    unsigned n_;
+};
+
+// Sample query templates, Sobol-stratified as in SampenCalculatorQR, and 
+// count the matches of each query against all templates exactly with an 
+// index. Only the queries are sampled, so the variance is much lower than 
+// sampling both templates of the pairs.
+class SampenCalculatorQuery: public SampenCalculatorSampling
+{
+public:
+    enum index_type {RANGE_TREE, KD_TREE, WIDE_TREE, SWEEP};
+    explicit SampenCalculatorQuery(
+        unsigned sample_num_, unsigned sample_size_, 
+        index_type type = SWEEP, bool random_ = false)
+        : SampenCalculatorSampling(sample_num_, sample_size_, random_), 
+        type(type)
+    {}
+
+private:
+    virtual void _ComputeRounds(
+        const vector<int> &data, unsigned m, int r, 
+        unsigned begin, unsigned end, vector<long long> &AB) override;
+    virtual void _Prepare(const vector<int> &data, unsigned m) override;
+    virtual void _Sample(
+        unsigned i, vector<unsigned> &indices) const override;
+    index_type type;
+    // The index is cached for the record and m it is built on
+    shared_ptr<const SampenIndex> index_;
+    index_type index_type_;
+    // Queries of the first round, the others are shifted by random offsets
+    vector<unsigned> indices_;
+};
+
 class SampenCalculatorCoreset 
 {
 public:
     explicit SampenCalculatorCoreset(
         unsigned sample_num_, unsigned sample_size_, bool random = false)
-        : sample_num(sample_num_), sample_size(sample_size_), random(random) 
+        : sample_num(sample_num_), sample_size(sample_size_), random(random), 
+        prepared_m_(0)
     {}
     void set_sample_num(unsigned sample_num_) { sample_num = sample_num_; }
     void set_sample_size(unsigned sample_size_)
@@ -167,11 +417,39 @@ public:
     double ComputeSampen(const vector<int> &data, unsigned m, int r, 
                          double *a, double *b);
 private:
+    // Build the sampling distribution, which is cached for data and m
+    void _Prepare(const vector<int> &data, unsigned m);
     vector<double> _ComputeAB(const vector<int> &data,
                               unsigned m, int r);
     unsigned sample_num;
     unsigned sample_size;
     bool random;
+    // The probabilities of the templates and their alias table
+    vector<double> q_;
+    alias_table table_;
+    vector<int> prepared_data_;
+    unsigned prepared_m_;
+};
+
+// Compute sample entropy approximately by kd tree. The nodes of the tree 
+// which intersect the range partially are not descended when they are 
+// small enough, and a subset of queries is counted exactly to correct the 
+// estimate. The approximation is refined until the error bound (two 
+// standard deviations, about 95% confidence) is within rel_err * sampen.
+class SampenCalculatorKDA
+{
+public:
+    explicit SampenCalculatorKDA(double rel_err) 
+        : rel_err_(rel_err), error_bound_(0) {}
+    void set_rel_err(double rel_err) { rel_err_ = rel_err; }
+    double ComputeSampen(const vector<int> &data, unsigned m, int r, 
+                         double *a, double *b);
+    // The bound of the absolute error of the last result
+    double error_bound() const { return error_bound_; }
+private:
+    double rel_err_;
+    double error_bound_;
+    shared_ptr<const SampenIndexKD> index_;
 };
 
 // Compute sample entropy using new kd tree
@@ -220,6 +498,30 @@ public:
         const vector<Point> &points, int r) override;
 };
 
+/*
+ * Count the templates j, begin <= j < end, within distance r of the i-th 
+ * template in a flat buffer, and add them to A (the first m coordinates) 
+ * and B (all m + 1 coordinates).
+ */
+void CountMatchedRange(const TemplateBuffer &templates, int r, unsigned i, 
+                       unsigned begin, unsigned end, 
+                       long long *A, long long *B);
+
+/*
+ * Count the matched pairs (i, j), i < j, of the templates in a flat buffer 
+ * for i = offset, offset + interval, ..., and add them to A and B.
+ */
+void CountMatchedFlat(const TemplateBuffer &templates, int r, 
+                      unsigned offset, unsigned interval, 
+                      long long *A, long long *B);
+
+// Compute A and B with templates in a flat buffer using direct method
+class ABCalculatorFlatD
+{
+public:
+    vector<long long> ComputeAB(const TemplateBuffer &templates, int r);
+};
+
 class ABCalculatorPointRT : public ABCalculatorPoint
 {
 public:
@@ -234,6 +536,23 @@ public:
                              const vector<double> &weights, int r);   
 };
 
+// Compute weighted A and B of sampled templates in a flat buffer. The 
+// duplicates of a template are collapsed into one template with the summed 
+// weight, and the pairs among the duplicates are added exactly, so that 
+// the result is the same as counting each sampled template separately.
+class ABCalculatorFlatWeighted
+{
+public:
+    /*
+     * @param indices: the sampled templates data[i], ..., data[i + m]
+     * @param weights: the weights of the sampled templates
+     */
+    vector<double> ComputeAB(const vector<int> &data, 
+                             const vector<unsigned> &indices, 
+                             const vector<double> &weights, 
+                             unsigned m, int r);
+};
+
 
 double ComputeSampenDirect(
     const vector<int> &data, unsigned m, int r, double *a, double *b);
@@ -244,6 +563,13 @@ double ComputeSampenRangetree(
 double ComputeSampenKdtree(
     const vector<int> &data, unsigned m, int r, double *a, double *b);
 
+double ComputeSampenWidetree(
+    const vector<int> &data, unsigned m, int r, double *a, double *b);
+
+double ComputeSampenKdtreeApprox(
+    const vector<int> &data, unsigned m, int r, double rel_err, 
+    double *a, double *b, double *error_bound);
+
 double ComputeSampenNkdtreeHist(
     const vector<int> &data, unsigned m, int r, 
     unsigned sample_size, unsigned sample_num, double *a, double *b);
@@ -262,6 +588,19 @@ double ComputeSampenQR2(
     const unsigned sample_size, const unsigned sample_num, 
     double *a, double *b);
 
+// ComputeSampenQR or ComputeSampenQR2 (presort) for each sample size
+vector<SampenEstimate> ComputeSampenQRSweep(
+    const vector<int> &data, unsigned m, int r, 
+    const vector<unsigned> &sample_sizes, unsigned sample_num, bool presort);
+
+double ComputeSampenPair(
+    const vector<int> &data, unsigned m, int r, 
+    unsigned sample_size, unsigned sample_num, double *a, double *b);
+
+double ComputeSampenQuery(
+    const vector<int> &data, unsigned m, int r, 
+    unsigned sample_size, unsigned sample_num, double *a, double *b);
+
 double ComputeSampenCoreset(
     const vector<int> &data, unsigned m, int r, 
     unsigned sample_size, unsigned sample_num, double *a, double *b);
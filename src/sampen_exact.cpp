@@ -0,0 +1,841 @@
+/* file: sampen_exact.cpp
+ * date: 2026-10-19
+ * author: phree
+ *
+ * description: implementation of the exact methods in sampen_exact.h
+ */
+#include <algorithm>
+#include <atomic>
+#include <limits.h>
+#include <math.h>
+#include <stdexcept>
+#include <stdint.h>
+#include <thread>
+
+#include "sampen_exact.h"
+#include "utils.h"
+
+vector<long long> CountABGrid(const vector<int> &data, unsigned m, int r)
+{
+    if (m == 0)
+        throw std::invalid_argument("m == 0");
+    if (data.size() <= m + 1)
+        throw std::invalid_argument("data.size() < m + 2");
+    if (r < 0)
+        throw std::invalid_argument("r < 0");
+    const unsigned n = data.size() - m;
+    const unsigned k = std::min(m, 3u);
+    // Coordinates within r differ by at most one cell of width r + 1
+    const long long min_data = *std::min_element(data.cbegin(), data.cend());
+    const long long width = r + 1LL;
+
+    // Number the occupied cells and bucket the templates by counting sort
+    CellTable table(k, n);
+    vector<unsigned> cell_of(n);
+    long long cell[3];
+    for (unsigned i = 0; i < n; i++)
+    {
+        for (unsigned d = 0; d < k; d++)
+            cell[d] = (data[i + d] - min_data) / width;
+        cell_of[i] = table.Insert(cell);
+    }
+    const unsigned num_cells = table.size();
+    vector<unsigned> offsets(num_cells + 1, 0);
+    for (unsigned i = 0; i < n; i++) offsets[cell_of[i] + 1]++;
+    for (unsigned c = 0; c < num_cells; c++) offsets[c + 1] += offsets[c];
+    vector<unsigned> order(n);
+    {
+        vector<unsigned> pos(offsets.begin(), offsets.end() - 1);
+        for (unsigned i = 0; i < n; i++) order[pos[cell_of[i]]++] = i;
+    }
+    TemplateBuffer templates;
+    templates.Gather(data, order, m + 1);
+
+    // Half of the neighbouring offsets, whose first non-zero coordinate is
+    // positive, so that each pair of adjacent cells is visited once
+    vector<vector<int> > steps;
+    unsigned num_steps = 1;
+    for (unsigned d = 0; d < k; d++) num_steps *= 3;
+    for (unsigned s = 0; s < num_steps; s++)
+    {
+        vector<int> step(k);
+        for (unsigned d = 0, t = s; d < k; d++, t /= 3)
+            step[k - 1 - d] = static_cast<int>(t % 3) - 1;
+        auto first = std::find_if(step.begin(), step.end(),
+                                  [](int x) { return x != 0; });
+        if (first != step.end() && *first > 0) steps.push_back(step);
+    }
+
+    // The forward neighbours of each cell
+    vector<vector<unsigned> > neighbours(num_cells);
+    ParallelFor(num_cells, [&](unsigned begin, unsigned end)
+    {
+        long long other[3];
+        for (unsigned c = begin; c < end; c++)
+        {
+            for (const vector<int> &step : steps)
+            {
+                for (unsigned d = 0; d < k; d++)
+                    other[d] = table.cell(c)[d] + step[d];
+                long long nc = table.Find(other);
+                if (nc >= 0) neighbours[c].push_back(nc);
+            }
+        }
+    }, 1024);
+
+    // Split the cells into chunks of rows, so that a crowded cell is shared
+    // by several threads, and hand out the chunks dynamically
+    const unsigned kRows = 64;
+    vector<unsigned> chunk_cell, chunk_begin;
+    for (unsigned c = 0; c < num_cells; c++)
+    {
+        for (unsigned i = offsets[c]; i < offsets[c + 1]; i += kRows)
+        {
+            chunk_cell.push_back(c);
+            chunk_begin.push_back(i);
+        }
+    }
+    const unsigned num_chunks = chunk_cell.size();
+    std::atomic<unsigned> next(0);
+    unsigned num_threads = std::max(
+        std::min(GetNumThreads(), num_chunks), 1u);
+    vector<long long> As(num_threads, 0), Bs(num_threads, 0);
+    auto run = [&](unsigned t)
+    {
+        long long a = 0, b = 0;
+        unsigned chunk;
+        while ((chunk = next.fetch_add(1)) < num_chunks)
+        {
+            unsigned c = chunk_cell[chunk];
+            unsigned end = std::min(chunk_begin[chunk] + kRows, 
+                                    offsets[c + 1]);
+            for (unsigned i = chunk_begin[chunk]; i < end; i++)
+            {
+                CountMatchedRange(templates, r, i, i + 1, offsets[c + 1],
+                                  &a, &b);
+                for (unsigned nc : neighbours[c])
+                    CountMatchedRange(templates, r, i, offsets[nc],
+                                      offsets[nc + 1], &a, &b);
+            }
+        }
+        As[t] = a;
+        Bs[t] = b;
+    };
+    vector<std::thread> threads;
+    for (unsigned t = 1; t < num_threads; t++)
+        threads.push_back(std::thread(run, t));
+    run(0);
+    for (auto &thread : threads) thread.join();
+
+    vector<long long> AB(2, 0);
+    for (unsigned t = 0; t < num_threads; t++)
+    {
+        AB[0] += As[t];
+        AB[1] += Bs[t];
+    }
+    return AB;
+}
+
+/*
+ * Counts of the templates over the cells of a dim-dimensional grid of size 
+ * (V + 1)^dim, turned into prefix sums in place, so that cell (c_0, ...) 
+ * holds the number of templates whose compressed coordinates are less than 
+ * (c_0, ...).
+ */
+static vector<unsigned> BuildSummedArea(const vector<unsigned> &compressed, 
+                                        unsigned n, unsigned dim, 
+                                        unsigned num_values)
+{
+    const size_t side = num_values + 1;
+    size_t total = 1;
+    for (unsigned d = 0; d < dim; d++) total *= side;
+    vector<unsigned> table(total, 0);
+    for (unsigned i = 0; i < n; i++)
+    {
+        size_t idx = 0;
+        for (unsigned d = 0; d < dim; d++)
+            idx = idx * side + compressed[i + d] + 1;
+        table[idx]++;
+    }
+    // Accumulate along each axis; the lines are independent, so they are
+    // split over the threads by the outer or the inner index
+    size_t stride = total;
+    for (unsigned d = 0; d < dim; d++)
+    {
+        stride /= side;
+        const size_t outer = total / (stride * side);
+        auto scan = [&](size_t o, size_t begin, size_t end)
+        {
+            unsigned *line = table.data() + o * stride * side;
+            for (size_t j = 1; j < side; j++)
+            {
+                for (size_t t = begin; t < end; t++)
+                    line[j * stride + t] += line[(j - 1) * stride + t];
+            }
+        };
+        if (outer >= stride)
+        {
+            ParallelFor(outer, [&](unsigned begin, unsigned end)
+            {
+                for (unsigned o = begin; o < end; o++) scan(o, 0, stride);
+            }, 64);
+        }
+        else 
+        {
+            ParallelFor(stride, [&](unsigned begin, unsigned end)
+            {
+                for (size_t o = 0; o < outer; o++) scan(o, begin, end);
+            }, 1024);
+        }
+    }
+    return table;
+}
+
+double SampenCalculatorSAT::TableMemory(const vector<int> &data, unsigned m)
+{
+    vector<int> values(data);
+    std::sort(values.begin(), values.end());
+    double num_values = 
+        std::unique(values.begin(), values.end()) - values.begin();
+    return 4 * pow(num_values + 1, m + 1);
+}
+
+vector<long long> CountABSummedArea(const vector<int> &data, unsigned m, 
+                                    int r)
+{
+    if (m == 0)
+        throw std::invalid_argument("m == 0");
+    if (data.size() <= m + 1)
+        throw std::invalid_argument("data.size() < m + 2");
+    if (r < 0)
+        throw std::invalid_argument("r < 0");
+    const unsigned N = data.size();
+    const unsigned n = N - m;
+    vector<int> values(data);
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    const size_t side = values.size() + 1;
+
+    // The compressed value of each sample, and the range [lower, upper) of
+    // the compressed values within r of it
+    vector<unsigned> compressed(N), lower(N), upper(N);
+    ParallelFor(N, [&](unsigned begin, unsigned end)
+    {
+        for (unsigned k = begin; k < end; k++)
+        {
+            auto first = values.cbegin(), last = values.cend();
+            compressed[k] = std::lower_bound(first, last, data[k]) - first;
+            lower[k] = std::lower_bound(
+                first, last, static_cast<long long>(data[k]) - r) - first;
+            upper[k] = std::upper_bound(
+                first, last, static_cast<long long>(data[k]) + r) - first;
+        }
+    });
+
+    // The counts of A are the prefix sums over all values of the last 
+    // coordinate, so one table serves both
+    vector<unsigned> table = BuildSummedArea(
+        compressed, n, m + 1, values.size());
+    vector<long long> AB(2, 0);
+    for (unsigned dim = m; dim <= m + 1; dim++)
+    {
+        std::atomic<long long> count(0);
+        ParallelFor(n, [&](unsigned begin, unsigned end)
+        {
+            long long local = 0;
+            for (unsigned i = begin; i < end; i++)
+            {
+                // Inclusion-exclusion over the corners of the box
+                for (unsigned corner = 0; corner < (1u << dim); corner++)
+                {
+                    size_t idx = 0;
+                    for (unsigned d = 0; d < dim; d++)
+                    {
+                        bool low = corner >> d & 1;
+                        idx = idx * side + (low ? lower[i + d] : upper[i + d]);
+                    }
+                    if (dim == m) idx = idx * side + side - 1;
+                    long long x = table[idx];
+                    local += __builtin_parity(corner) ? -x : x;
+                }
+            }
+            count += local;
+        });
+        // Each template matches itself, and each pair is seen twice
+        AB[dim - m] = (count - n) / 2;
+    }
+    return AB;
+}
+
+// A template (weight 0) or a corner of a box (weight +1 or -1) in the 
+// compressed coordinates
+struct DominanceItem
+{
+    unsigned c[4];
+    int weight;
+};
+
+// Order by the d-th coordinate, templates before corners on ties, so that 
+// a template dominated by a corner always comes first
+struct DominanceLess
+{
+    unsigned d;
+    bool operator()(const DominanceItem &x, const DominanceItem &y) const
+    {
+        if (x.c[d] != y.c[d]) return x.c[d] < y.c[d];
+        return (x.weight == 0) > (y.weight == 0);
+    }
+};
+
+static long long CountDominance(vector<DominanceItem> &items, unsigned d, 
+                                unsigned dim, vector<unsigned> &fenwick, 
+                                unsigned parallel_depth);
+
+/*
+ * The part of CountDominance on items[begin, end), which is left sorted by 
+ * DominanceLess{d}. The pairs in each half are counted recursively, and the 
+ * pairs across the halves, whose order is settled, on the next coordinate.
+ */
+static long long CountDominanceCDQ(
+    vector<DominanceItem> &items, unsigned begin, unsigned end, unsigned d, 
+    unsigned dim, vector<unsigned> &fenwick, unsigned parallel_depth)
+{
+    DominanceLess less = {d};
+    const unsigned kBase = 16;
+    long long total = 0;
+    if (end - begin <= kBase)
+    {
+        for (unsigned j = begin; j < end; j++)
+        {
+            if (items[j].weight == 0) continue;
+            for (unsigned i = begin; i < j; i++)
+            {
+                bool dominated = items[i].weight == 0;
+                for (unsigned k = d; k < dim && dominated; k++)
+                    dominated = items[i].c[k] <= items[j].c[k];
+                if (dominated) total += items[j].weight;
+            }
+        }
+        std::stable_sort(items.begin() + begin, items.begin() + end, less);
+        return total;
+    }
+    unsigned mid = begin + (end - begin) / 2;
+    if (parallel_depth > 0)
+    {
+        long long left = 0;
+        std::thread thread([&]()
+        {
+            vector<unsigned> own(fenwick.size(), 0);
+            left = CountDominanceCDQ(items, begin, mid, d, dim, own, 
+                                     parallel_depth - 1);
+        });
+        total += CountDominanceCDQ(items, mid, end, d, dim, fenwick, 
+                                   parallel_depth - 1);
+        thread.join();
+        total += left;
+    }
+    else 
+    {
+        total += CountDominanceCDQ(items, begin, mid, d, dim, fenwick, 0);
+        total += CountDominanceCDQ(items, mid, end, d, dim, fenwick, 0);
+    }
+
+    // The templates of the left half and the corners of the right half, 
+    // merged by the d-th coordinate
+    vector<DominanceItem> cross;
+    auto left_end = items.begin() + mid, right_end = items.begin() + end;
+    auto x = items.begin() + begin, y = left_end;
+    while (x != left_end || y != right_end)
+    {
+        if (x != left_end && x->weight != 0) { x++; continue; }
+        if (y != right_end && y->weight == 0) { y++; continue; }
+        if (y == right_end || (x != left_end && !less(*y, *x))) 
+            cross.push_back(*x++);
+        else 
+            cross.push_back(*y++);
+    }
+    if (cross.size() > 1)
+        total += CountDominance(cross, d + 1, dim, fenwick, 0);
+    std::inplace_merge(items.begin() + begin, left_end, right_end, less);
+    return total;
+}
+
+/*
+ * The sum of the weights of the corners q times the number of templates p 
+ * before q in items with p.c[k] <= q.c[k] for d <= k < dim. The Fenwick 
+ * tree is zero before and after the call.
+ */
+static long long CountDominance(vector<DominanceItem> &items, unsigned d, 
+                                unsigned dim, vector<unsigned> &fenwick, 
+                                unsigned parallel_depth)
+{
+    long long total = 0;
+    if (d == dim)
+    {
+        long long before = 0;
+        for (const DominanceItem &item : items)
+        {
+            if (item.weight == 0) before++;
+            else total += item.weight * before;
+        }
+    }
+    else if (d + 1 == dim)
+    {
+        // Sweep in order with the counts of the templates by coordinate
+        const unsigned size = fenwick.size();
+        for (const DominanceItem &item : items)
+        {
+            if (item.weight == 0) 
+            {
+                for (unsigned k = item.c[d]; k < size; k |= k + 1)
+                    fenwick[k]++;
+            }
+            else 
+            {
+                long long count = 0;
+                for (long long k = item.c[d]; k >= 0; k = (k & (k + 1)) - 1)
+                    count += fenwick[k];
+                total += item.weight * count;
+            }
+        }
+        for (const DominanceItem &item : items)
+        {
+            if (item.weight != 0) continue;
+            for (unsigned k = item.c[d]; k < size; k |= k + 1)
+                fenwick[k]--;
+        }
+    }
+    else 
+    {
+        total = CountDominanceCDQ(items, 0, items.size(), d, dim, fenwick, 
+                                  parallel_depth);
+    }
+    return total;
+}
+
+vector<long long> CountABDominance(const vector<int> &data, unsigned m, 
+                                   int r)
+{
+    if (m == 0 || m > 3)
+        throw std::invalid_argument("m should be in [1, 3]");
+    if (data.size() <= m + 1)
+        throw std::invalid_argument("data.size() < m + 2");
+    if (r < 0)
+        throw std::invalid_argument("r < 0");
+    const unsigned N = data.size();
+    const unsigned n = N - m;
+    vector<int> values(data);
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+
+    // The rank of each sample in 1, ..., V, and the numbers of the values 
+    // below x - r and not above x + r, so that a template p lies in the 
+    // box of x iff low < p <= high on each coordinate
+    vector<unsigned> rank(N), low(N), high(N);
+    ParallelFor(N, [&](unsigned begin, unsigned end)
+    {
+        for (unsigned k = begin; k < end; k++)
+        {
+            auto first = values.cbegin(), last = values.cend();
+            rank[k] = std::lower_bound(first, last, data[k]) - first + 1;
+            low[k] = std::lower_bound(
+                first, last, static_cast<long long>(data[k]) - r) - first;
+            high[k] = std::upper_bound(
+                first, last, static_cast<long long>(data[k]) + r) - first;
+        }
+    });
+
+    unsigned parallel_depth = 0;
+    while ((1u << parallel_depth) < GetNumThreads()) parallel_depth++;
+    vector<long long> AB(2, 0);
+    for (unsigned dim = m; dim <= m + 1; dim++)
+    {
+        vector<DominanceItem> items;
+        items.reserve((static_cast<size_t>(n) << dim) + n);
+        for (unsigned i = 0; i < n; i++)
+        {
+            DominanceItem item = {{0, 0, 0, 0}, 0};
+            for (unsigned d = 0; d < dim; d++) item.c[d] = rank[i + d];
+            items.push_back(item);
+            for (unsigned corner = 0; corner < (1u << dim); corner++)
+            {
+                bool empty = false;
+                for (unsigned d = 0; d < dim; d++)
+                {
+                    item.c[d] = corner >> d & 1 ? low[i + d] : high[i + d];
+                    empty |= item.c[d] == 0;
+                }
+                item.weight = __builtin_parity(corner) ? -1 : 1;
+                if (!empty) items.push_back(item);
+            }
+        }
+        std::sort(items.begin(), items.end(), DominanceLess{0});
+        vector<unsigned> fenwick(values.size() + 1, 0);
+        long long count = CountDominance(items, 1, dim, fenwick, 
+                                         parallel_depth);
+        // Each template matches itself, and each pair is seen twice
+        AB[dim - m] = (count - n) / 2;
+    }
+    return AB;
+}
+
+double SampenCalculatorBitset::BitsetMemory(const vector<int> &data)
+{
+    vector<int> values(data);
+    std::sort(values.begin(), values.end());
+    double num_values = 
+        std::unique(values.begin(), values.end()) - values.begin();
+    return num_values * ((data.size() + 63) / 64 + 1) * 8;
+}
+
+vector<long long> CountABBitset(const vector<int> &data, unsigned m, int r)
+{
+    if (m == 0)
+        throw std::invalid_argument("m == 0");
+    if (data.size() <= m + 1)
+        throw std::invalid_argument("data.size() < m + 2");
+    if (r < 0)
+        throw std::invalid_argument("r < 0");
+    const unsigned N = data.size();
+    const unsigned n = N - m;
+    if (m >= 64)
+        return CountABGrid(data, m, r);
+    vector<int> values(data);
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    const unsigned num_values = values.size();
+    vector<unsigned> value_of(N);
+    for (unsigned k = 0; k < N; k++)
+    {
+        value_of[k] = std::lower_bound(values.cbegin(), values.cend(), 
+                                       data[k]) - values.cbegin();
+    }
+
+    // The samples within r of each value are a range of the sorted samples; 
+    // one more zero word at the end allows reading the word after the last
+    const size_t words = (N + 63) / 64 + 1;
+    vector<unsigned> order = SortTemplates(data, 1, N);
+    vector<uint64_t> bits(num_values * words, 0);
+    ParallelFor(num_values, [&](unsigned begin, unsigned end)
+    {
+        auto less = [&](unsigned k, long long x) { return data[k] < x; };
+        auto greater = [&](long long x, unsigned k) { return x < data[k]; };
+        for (unsigned v = begin; v < end; v++)
+        {
+            uint64_t *row = bits.data() + v * words;
+            auto first = std::lower_bound(order.cbegin(), order.cend(), 
+                static_cast<long long>(values[v]) - r, less);
+            auto last = std::upper_bound(first, order.cend(), 
+                static_cast<long long>(values[v]) + r, greater);
+            for (auto k = first; k != last; k++)
+                row[*k / 64] |= 1ull << (*k % 64);
+        }
+    }, 64);
+
+    // Templates j > i, in chunks handed out dynamically since the earlier 
+    // templates have more work
+    const unsigned kRows = 64;
+    const unsigned num_chunks = (n + kRows - 1) / kRows;
+    std::atomic<unsigned> next(0);
+    unsigned num_threads = std::max(
+        std::min(GetNumThreads(), num_chunks), 1u);
+    vector<long long> As(num_threads, 0), Bs(num_threads, 0);
+    auto run = [&](unsigned t)
+    {
+        long long a = 0, b = 0;
+        vector<const uint64_t *> rows(m + 1);
+        unsigned chunk;
+        while ((chunk = next.fetch_add(1)) < num_chunks)
+        {
+            unsigned end = std::min((chunk + 1) * kRows, n);
+            for (unsigned i = chunk * kRows; i < end; i++)
+            {
+                for (unsigned d = 0; d <= m; d++)
+                    rows[d] = bits.data() + value_of[i + d] * words;
+                // Words of j in [i + 1, n), masked at both ends
+                const unsigned w0 = (i + 1) / 64, w1 = (n - 1) / 64;
+                for (unsigned w = w0; w <= w1; w++)
+                {
+                    uint64_t x = ~0ull;
+                    if (w == w0) x <<= (i + 1) % 64;
+                    if (w == w1 && n % 64) x &= ~0ull >> (64 - n % 64);
+                    for (unsigned d = 0; d < m; d++)
+                    {
+                        const uint64_t *row = rows[d] + w;
+                        x &= d ? row[0] >> d | row[1] << (64 - d) : row[0];
+                    }
+                    a += __builtin_popcountll(x);
+                    const uint64_t *row = rows[m] + w;
+                    x &= row[0] >> m | row[1] << (64 - m);
+                    b += __builtin_popcountll(x);
+                }
+            }
+        }
+        As[t] = a;
+        Bs[t] = b;
+    };
+    vector<std::thread> threads;
+    for (unsigned t = 1; t < num_threads; t++)
+        threads.push_back(std::thread(run, t));
+    run(0);
+    for (auto &thread : threads) thread.join();
+
+    vector<long long> AB(2, 0);
+    for (unsigned t = 0; t < num_threads; t++)
+    {
+        AB[0] += As[t];
+        AB[1] += Bs[t];
+    }
+    return AB;
+}
+
+vector<long long> CountABEqual(const vector<int> &data, unsigned m)
+{
+    if (data.size() <= m + 1)
+        throw std::invalid_argument("data.size() < m + 2");
+    const unsigned N = data.size();
+    const unsigned n = N - m;
+    // prefix[k] is the polynomial hash of data[0], ..., data[k - 1] modulo 
+    // 2^64, so that the hash of a template is a difference of two prefixes
+    const uint64_t kBase = 0x100000001B3ull;
+    vector<uint64_t> prefix(N + 1, 0);
+    for (unsigned k = 0; k < N; k++)
+        prefix[k + 1] = prefix[k] * kBase + static_cast<uint32_t>(data[k]);
+
+    unsigned capacity = 2;
+    while (capacity < 2 * n) capacity <<= 1;
+    vector<uint64_t> hashes(n);
+    vector<unsigned> slots(capacity), counts(capacity);
+    vector<long long> AB(2, 0);
+    for (unsigned dim = m; dim <= m + 1; dim++)
+    {
+        uint64_t power = 1;
+        for (unsigned d = 0; d < dim; d++) power *= kBase;
+        ParallelFor(n, [&](unsigned begin, unsigned end)
+        {
+            for (unsigned i = begin; i < end; i++)
+            {
+                uint64_t h = prefix[i + dim] - prefix[i] * power;
+                h ^= h >> 33;
+                h *= 0xFF51AFD7ED558CCDull;
+                hashes[i] = h ^ h >> 33;
+            }
+        });
+        // Each slot holds the first template of a group plus one, and the 
+        // number of the templates of the group seen so far
+        std::fill(slots.begin(), slots.end(), 0);
+        std::fill(counts.begin(), counts.end(), 0);
+        long long pairs = 0;
+        for (unsigned i = 0; i < n; i++)
+        {
+            unsigned pos = hashes[i] & (capacity - 1);
+            while (slots[pos])
+            {
+                unsigned j = slots[pos] - 1;
+                if (hashes[j] == hashes[i] && std::equal(
+                        data.begin() + i, data.begin() + i + dim, 
+                        data.begin() + j))
+                    break;
+                pos = (pos + 1) & (capacity - 1);
+            }
+            if (!slots[pos]) slots[pos] = i + 1;
+            pairs += counts[pos]++;
+        }
+        AB[dim - m] = pairs;
+    }
+    return AB;
+}
+
+EntropyStatistics ComputeEntropyStatistics(
+    const vector<int> &data, unsigned m, int r, double fuzzy_power)
+{
+    if (data.size() <= m + 1)
+        throw std::invalid_argument("data.size() < m + 2");
+    if (r < 0)
+        throw std::invalid_argument("r < 0");
+    if (!(fuzzy_power > 0))
+        throw std::invalid_argument("fuzzy_power should be positive");
+    const unsigned N = data.size();
+    const unsigned n = N - m;
+    vector<unsigned> indices(n);
+    for (unsigned i = 0; i < n; i++) indices[i] = i;
+    TemplateBuffer templates;
+    templates.Gather(data, indices, m + 1);
+    const bool fuzzy = r > 0;
+    const double cutoff = fuzzy ? r * pow(40., 1 / fuzzy_power) : 0;
+    // No distance exceeds the range of the data
+    const long long range = 
+        static_cast<long long>(*std::max_element(data.cbegin(), data.cend())) -
+        *std::min_element(data.cbegin(), data.cend());
+    const int max_distance = static_cast<int>(std::min(
+        cutoff, static_cast<double>(std::min<long long>(range, INT_MAX))));
+    // The membership of each distance up to the cutoff
+    vector<double> membership(max_distance + 1, 0);
+    for (int d = 0; d <= max_distance && fuzzy; d++)
+        membership[d] = exp(-pow(static_cast<double>(d) / r, fuzzy_power));
+
+    // Each thread keeps the matches of each template of its pairs, on m 
+    // and m + 1 coordinates, and the memberships summed over its pairs
+    const unsigned num_threads = std::max(
+        std::min(GetNumThreads(), n / 64), 1u);
+    vector<vector<unsigned> > counts_a(num_threads), counts_b(num_threads);
+    vector<double> fuzzy_a(num_threads, 0), fuzzy_b(num_threads, 0);
+    auto run = [&](unsigned t)
+    {
+        const unsigned kBlock = 256;
+        int dist_a[kBlock], dist_b[kBlock];
+        vector<unsigned> &count_a = counts_a[t], &count_b = counts_b[t];
+        count_a.assign(n, 0);
+        count_b.assign(n, 0);
+        double sum_a = 0, sum_b = 0;
+        for (unsigned i = t; i < n; i += num_threads)
+        {
+            for (unsigned j0 = i + 1; j0 < n; j0 += kBlock)
+            {
+                const unsigned len = std::min(kBlock, n - j0);
+                for (unsigned k = 0; k < len; k++)
+                    dist_a[k] = 0;
+                for (unsigned d = 0; d < m; d++)
+                {
+                    const int *x = templates.coord(d) + j0;
+                    const int y = templates.coord(d)[i];
+                    for (unsigned k = 0; k < len; k++)
+                        dist_a[k] = std::max(dist_a[k], std::abs(x[k] - y));
+                }
+                const int *x = templates.coord(m) + j0;
+                const int y = templates.coord(m)[i];
+                unsigned a = 0, b = 0;
+                for (unsigned k = 0; k < len; k++)
+                {
+                    dist_b[k] = std::max(dist_a[k], std::abs(x[k] - y));
+                    unsigned match_a = dist_a[k] <= r;
+                    unsigned match_b = dist_b[k] <= r;
+                    a += match_a;
+                    b += match_b;
+                    count_a[j0 + k] += match_a;
+                    count_b[j0 + k] += match_b;
+                }
+                count_a[i] += a;
+                count_b[i] += b;
+                if (!fuzzy) continue;
+                for (unsigned k = 0; k < len; k++)
+                {
+                    if (dist_a[k] > max_distance) continue;
+                    sum_a += membership[dist_a[k]];
+                    if (dist_b[k] <= max_distance) 
+                        sum_b += membership[dist_b[k]];
+                }
+            }
+        }
+        fuzzy_a[t] = sum_a;
+        fuzzy_b[t] = sum_b;
+    };
+    vector<std::thread> threads;
+    for (unsigned t = 1; t < num_threads; t++)
+        threads.push_back(std::thread(run, t));
+    run(0);
+    for (auto &thread : threads) thread.join();
+
+    // The matches of the templates with themselves, and the last template 
+    // of length m, which has no template of length m + 1
+    vector<long long> matches_a(n + 1, 1), matches_b(n, 1);
+    double sum_a = 0, sum_b = 0;
+    for (unsigned t = 0; t < num_threads; t++)
+    {
+        for (unsigned i = 0; i < n; i++)
+        {
+            matches_a[i] += counts_a[t][i];
+            matches_b[i] += counts_b[t][i];
+        }
+        sum_a += fuzzy_a[t];
+        sum_b += fuzzy_b[t];
+    }
+    EntropyStatistics stats;
+    stats.a = 0;
+    stats.b = 0;
+    for (unsigned i = 0; i < n; i++)
+    {
+        stats.a += matches_a[i] - 1;
+        stats.b += matches_b[i] - 1;
+    }
+    stats.a /= 2;
+    stats.b /= 2;
+    for (unsigned j = 0; j < n; j++)
+    {
+        bool matched = true;
+        for (unsigned d = 0; d < m && matched; d++)
+            matched = std::abs(data[n + d] - data[j + d]) <= r;
+        matches_a[j] += matched;
+        matches_a[n] += matched;
+    }
+
+    stats.sampen = ComputeSampenAB(stats.a, stats.b, N, m);
+    double phi_a = 0, phi_b = 0;
+    for (unsigned i = 0; i <= n; i++)
+        phi_a += log(matches_a[i] / (n + 1.));
+    for (unsigned i = 0; i < n; i++)
+        phi_b += log(matches_b[i] / static_cast<double>(n));
+    stats.apen = phi_a / (n + 1) - phi_b / n;
+    stats.fuzzyen = fuzzy ? log(sum_a / sum_b) : NAN;
+    return stats;
+}
+
+vector<long long> SampenCalculatorGrid::_ComputeAB(
+    const vector<int> &data, unsigned m, int r)
+{
+    return CountABGrid(data, m, r);
+}
+
+vector<long long> SampenCalculatorSAT::_ComputeAB(
+    const vector<int> &data, unsigned m, int r)
+{
+    if (m == 0)
+        throw std::invalid_argument("m == 0");
+    if (TableMemory(data, m) > memory_budget_)
+        return CountABGrid(data, m, r);
+    return CountABSummedArea(data, m, r);
+}
+
+vector<long long> SampenCalculatorCDQ::_ComputeAB(
+    const vector<int> &data, unsigned m, int r)
+{
+    if (m == 0 || m > 3)
+        return CountABGrid(data, m, r);
+    return CountABDominance(data, m, r);
+}
+
+vector<long long> SampenCalculatorBitset::_ComputeAB(
+    const vector<int> &data, unsigned m, int r)
+{
+    if (BitsetMemory(data) > memory_budget_)
+        return CountABGrid(data, m, r);
+    return CountABBitset(data, m, r);
+}
+
+double ComputeSampenGrid(
+    const vector<int> &data, unsigned m, int r, double *a, double *b)
+{
+    SampenCalculatorGrid sc;
+    return sc.ComputeEntropy(data, m, r, a, b);
+}
+
+double ComputeSampenSAT(
+    const vector<int> &data, unsigned m, int r, double *a, double *b)
+{
+    SampenCalculatorSAT sc;
+    return sc.ComputeEntropy(data, m, r, a, b);
+}
+
+double ComputeSampenCDQ(
+    const vector<int> &data, unsigned m, int r, double *a, double *b)
+{
+    SampenCalculatorCDQ sc;
+    return sc.ComputeEntropy(data, m, r, a, b);
+}
+
+double ComputeSampenBitset(
+    const vector<int> &data, unsigned m, int r, double *a, double *b)
+{
+    SampenCalculatorBitset sc;
+    return sc.ComputeEntropy(data, m, r, a, b);
+}
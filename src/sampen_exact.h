@@ -0,0 +1,142 @@
+/* file: sampen_exact.h
+ * date: 2026-10-19
+ * author: phree
+ *
+ * description: exact methods to compute sample entropy whose structures 
+ *   depend on r, so that they are rebuilt for each call.
+ */
+
+#ifndef __SAMPEN_EXACT_H__
+#define __SAMPEN_EXACT_H__
+
+#include <vector>
+
+#include "sampen_calculator.h"
+
+using std::vector;
+
+// A and B by the methods below, each pair is counted once
+vector<long long> CountABGrid(const vector<int> &data, unsigned m, int r);
+vector<long long> CountABSummedArea(const vector<int> &data, unsigned m, 
+                                    int r);
+vector<long long> CountABDominance(const vector<int> &data, unsigned m, 
+                                   int r);
+vector<long long> CountABBitset(const vector<int> &data, unsigned m, int r);
+/*
+ * A and B for r = 0, i.e., the pairs of identical templates. The templates 
+ * are grouped by a rolling hash in a hash table, checked for equality, and 
+ * each group of k templates adds k (k - 1) / 2 pairs, in O(N m) time.
+ */
+vector<long long> CountABEqual(const vector<int> &data, unsigned m);
+
+// Entropies of a record computed together by ComputeEntropyStatistics
+struct EntropyStatistics
+{
+    // Sample entropy and its A and B, each pair counted once
+    double sampen;
+    long long a;
+    long long b;
+    // Approximate entropy, whose counts include the self-matches
+    double apen;
+    // Fuzzy entropy with the membership exp(-(d / r)^n) of the Chebyshev 
+    // distance d of the templates
+    double fuzzyen;
+};
+
+/*
+ * Compute sample entropy, approximate entropy and fuzzy entropy in one 
+ * pass over the pairs of templates, which share the Chebyshev distances on 
+ * m and m + 1 coordinates. The distances are those of the raw templates, 
+ * i.e., without removing the mean of each template for fuzzy entropy. The 
+ * pairs farther than r 40^(1 / n) add less than e^-40 to fuzzy entropy and 
+ * are skipped, and fuzzy entropy is NAN for r = 0.
+ *
+ * @param fuzzy_power: the power n of the membership of fuzzy entropy
+ */
+EntropyStatistics ComputeEntropyStatistics(
+    const vector<int> &data, unsigned m, int r, double fuzzy_power = 2);
+
+/*
+ * Uniform grid of cell width r + 1 on the first k = min(m, 3) coordinates 
+ * of the templates. Two templates within distance r lie in the same or 
+ * adjacent cells, so each template is only compared with the templates of 
+ * the 3^k neighbouring cells. Only the occupied cells are stored in a hash 
+ * table, and the templates are laid out cell by cell in a flat buffer.
+ */
+class SampenCalculatorGrid : public SampenCalculator
+{
+private:
+    virtual vector<long long> _ComputeAB(
+        const vector<int> &data, unsigned m, int r) override;
+};
+
+/*
+ * Summed-area table of the template counts over the compressed values, 
+ * i.e., the distinct values of the data. The templates within distance r 
+ * of a template form a box, which is counted with 2^m lookups for A and 
+ * 2^(m + 1) for B. The table takes 4 (V + 1)^(m + 1) bytes for V distinct 
+ * values; SampenCalculatorGrid is used when it exceeds the memory budget. 
+ * m should be positive.
+ */
+class SampenCalculatorSAT : public SampenCalculator
+{
+public:
+    explicit SampenCalculatorSAT(double memory_budget = 1e9)
+        : memory_budget_(memory_budget) {}
+    // Bytes of the table for data and m
+    static double TableMemory(const vector<int> &data, unsigned m);
+private:
+    virtual vector<long long> _ComputeAB(
+        const vector<int> &data, unsigned m, int r) override;
+    double memory_budget_;
+};
+
+/*
+ * Offline counting of all the boxes together. Each box is split into 2^k 
+ * dominance queries by inclusion-exclusion, k = m for A and m + 1 for B, 
+ * which are answered by divide and conquer (CDQ) on the coordinates but 
+ * the last one, and a Fenwick tree over the compressed values of the last 
+ * one. The time is O(2^k N log^(k - 1) N) without the memory of a range 
+ * tree. SampenCalculatorGrid is used for m > 3.
+ */
+class SampenCalculatorCDQ : public SampenCalculator
+{
+private:
+    virtual vector<long long> _ComputeAB(
+        const vector<int> &data, unsigned m, int r) override;
+};
+
+/*
+ * Bitsets of the 1-D matches: the bitset of a value v has bit j set iff 
+ * |data[j] - v| <= r. The templates matching template i are the AND of the 
+ * bitsets of data[i + d] shifted by d, d < m, counted by popcount, and one 
+ * more AND gives B, so that the time is O(N^2 m / 64) word operations. The 
+ * bitsets take V N / 8 bytes for V distinct values; SampenCalculatorGrid 
+ * is used when they exceed the memory budget.
+ */
+class SampenCalculatorBitset : public SampenCalculator
+{
+public:
+    explicit SampenCalculatorBitset(double memory_budget = 1e9)
+        : memory_budget_(memory_budget) {}
+    // Bytes of the bitsets for data
+    static double BitsetMemory(const vector<int> &data);
+private:
+    virtual vector<long long> _ComputeAB(
+        const vector<int> &data, unsigned m, int r) override;
+    double memory_budget_;
+};
+
+double ComputeSampenGrid(
+    const vector<int> &data, unsigned m, int r, double *a, double *b);
+
+double ComputeSampenSAT(
+    const vector<int> &data, unsigned m, int r, double *a, double *b);
+
+double ComputeSampenCDQ(
+    const vector<int> &data, unsigned m, int r, double *a, double *b);
+
+double ComputeSampenBitset(
+    const vector<int> &data, unsigned m, int r, double *a, double *b);
+
+#endif // __SAMPEN_EXACT_H__
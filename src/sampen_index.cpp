@@ -0,0 +1,303 @@
+/* file: sampen_index.cpp
+ * date: 2026-10-19
+ * author: phree
+ *
+ * description: implementation of the indices used to compute sample entropy
+ */
+#include <algorithm>
+#include <math.h>
+#include <stdexcept>
+
+#include "sampen_index.h"
+
+long long CountPointsRT(const RT::RangeTree<int, int> &rtree,
+                        const vector<Point> &points,
+                        const unsigned m, const int r)
+{
+    vector<int> lower(m, 0), upper(m, 0);
+
+    /* counting */
+    long long result = 0;
+    for (vector<int>::size_type i = 0; i < points.size(); i++)
+    {
+        for (unsigned j = 0; j < m; j++)
+        {
+            lower[j] = points[i][j] - r;
+            upper[j] = points[i][j] + r;
+        }
+        result += rtree.countInRange(lower, upper);
+    }
+    return result;
+}
+
+SampenIndexRT::SampenIndexRT(const vector<int> &data, unsigned m)
+    : SampenIndex(data, m), points_(GetPoints(data, m + 1))
+{
+    vector<Point> _points(points_.size());
+    std::transform(points_.begin(), points_.end(), _points.begin(),
+                   [](const Point &p) -> Point { return p.drop_last(); });
+    tree_m_ = std::make_shared<RT::RangeTree<int, int> >(_points);
+    tree_m1_ = std::make_shared<RT::RangeTree<int, int> >(points_);
+}
+
+vector<long long> SampenIndexRT::ComputeAB(int r) const
+{
+    long long n = points_.size();
+    vector<long long> result(2);
+    result[0] = CountPointsRT(*tree_m_, points_, m_, r) - n;
+    result[1] = CountPointsRT(*tree_m1_, points_, m_ + 1, r) - n;
+    return result;
+}
+
+void SampenIndexRT::CountTemplate(unsigned i, int r, 
+                                  long long *a, long long *b) const
+{
+    vector<int> lower(m_ + 1), upper(m_ + 1);
+    for (unsigned j = 0; j <= m_; j++)
+    {
+        lower[j] = points_[i][j] - r;
+        upper[j] = points_[i][j] + r;
+    }
+    *b += tree_m1_->countInRange(lower, upper);
+    lower.pop_back();
+    upper.pop_back();
+    *a += tree_m_->countInRange(lower, upper);
+}
+
+SampenIndexKD::SampenIndexKD(const vector<int> &data, unsigned m)
+    : SampenIndex(data, m)
+{
+    unsigned N = data_.size();
+    unsigned n = N - m + 1;
+
+    int **datap = (int **)malloc(n * sizeof(int *));
+    for (unsigned i = 0; i < n; i++)
+        datap[i] = data_.data() + i;
+
+    tree_m_ = build_kdtree((const int **)datap, n - 1, m, 0, 0);
+    tree_m1_ = build_kdtree((const int **)datap, n - 1, m + 1, 0, 0);
+    free(datap);
+}
+
+SampenIndexKD::~SampenIndexKD()
+{
+    free_kdtree(tree_m_);
+    free_kdtree(tree_m1_);
+}
+
+vector<long long> SampenIndexKD::ComputeAB(int r) const
+{
+    long long A = 0, B = 0;
+    unsigned N = data_.size();
+    for (unsigned i = 0; i < N - m_; i++)
+    {
+        A += count_range_kdtree(tree_m_, data_.data() + i, m_, r);
+    }
+
+    for (unsigned i = 0; i < N - m_; i++)
+    {
+        B += count_range_kdtree(tree_m1_, data_.data() + i, m_ + 1, r);
+    }
+
+    A -= (N - m_);
+    B -= (N - m_);
+
+    vector<long long> result(2);
+    result[0] = A;
+    result[1] = B;
+    return result;
+}
+
+void SampenIndexKD::CountTemplate(unsigned i, int r, 
+                                  long long *a, long long *b) const
+{
+    *a += count_range_kdtree(tree_m_, data_.data() + i, m_, r);
+    *b += count_range_kdtree(tree_m1_, data_.data() + i, m_ + 1, r);
+}
+
+// Difference estimator of the sum of the counts of all queries: the 
+// approximate counts of all queries plus the mean difference between the 
+// exact and the approximate counts of every stride-th query
+static double EstimateCountKD(struct kdtree *tree, const int *data, 
+                              unsigned n, unsigned m, int r, 
+                              unsigned max_nump, unsigned stride, 
+                              double *var)
+{
+    double sum = 0, sum_diff = 0, sum_diff2 = 0;
+    unsigned num_exact = 0;
+    for (unsigned i = 0; i < n; i++)
+    {
+        double count = count_range_kdtree_approx(
+            tree, data + i, m, r, max_nump);
+        sum += count;
+        if (i % stride == stride / 2)
+        {
+            double diff = count_range_kdtree(tree, data + i, m, r) - count;
+            sum_diff += diff;
+            sum_diff2 += diff * diff;
+            num_exact++;
+        }
+    }
+    if (num_exact == 0)
+    {
+        *var = 0;
+        return sum;
+    }
+    double mean_diff = sum_diff / num_exact;
+    double var_diff = 0;
+    if (num_exact > 1)
+    {
+        var_diff = (sum_diff2 - num_exact * mean_diff * mean_diff) / 
+            (num_exact - 1);
+    }
+    // Exact when every query is counted exactly
+    double fpc = 1. - static_cast<double>(num_exact) / n;
+    *var = static_cast<double>(n) * n * var_diff / num_exact * fpc;
+    return sum + mean_diff * n;
+}
+
+vector<double> SampenIndexKD::ComputeABApprox(
+    int r, unsigned max_nump, unsigned stride, 
+    double *var_a, double *var_b) const
+{
+    unsigned N = data_.size();
+    double var_A = 0, var_B = 0;
+    double A = EstimateCountKD(tree_m_, data_.data(), N - m_, m_, r, 
+                                max_nump, stride, &var_A);
+    double B = EstimateCountKD(tree_m1_, data_.data(), N - m_, m_ + 1, r, 
+                                max_nump, stride, &var_B);
+
+    A -= (N - m_);
+    B -= (N - m_);
+    if (var_a) *var_a = var_A;
+    if (var_b) *var_b = var_B;
+
+    vector<double> result(2);
+    result[0] = A;
+    result[1] = B;
+    return result;
+}
+
+SampenIndexKDG::SampenIndexKDG(const vector<int> &data, unsigned m)
+    : SampenIndex(data, m)
+{
+    unsigned N = data_.size();
+    int max_ = *std::max_element(data_.cbegin(), data_.cend());
+    int min_ = *std::min_element(data_.cbegin(), data_.cend());
+    unsigned p = GridDepth(static_cast<long long>(max_) - min_);
+    shifted_.resize(N);
+    for (unsigned i = 0; i < N; i++) shifted_[i] = data_[i] - min_;
+    tree_m_ = build_kdtree_grid(shifted_.data(), N - 1, m, p);
+    tree_m1_ = build_kdtree_grid(shifted_.data(), N, m + 1, p);
+}
+
+unsigned SampenIndexKDG::GridDepth(long long range)
+{
+    unsigned p = 0;
+    while ((1LL << p) - 1 < range) p++;
+    if (p > 30)
+        throw std::invalid_argument("the range of data is too large");
+    return p;
+}
+
+SampenIndexKDG::~SampenIndexKDG()
+{
+    free_kdtree(tree_m_);
+    free_kdtree(tree_m1_);
+}
+
+vector<long long> SampenIndexKDG::ComputeAB(int r) const
+{
+    long long A = 0, B = 0;
+    unsigned N = data_.size();
+    for (unsigned i = 0; i < N - m_; i++)
+    {
+        A += count_range_kdtree(tree_m_, shifted_.data() + i, m_, r);
+    }
+
+    for (unsigned i = 0; i < N - m_; i++)
+    {
+        B += count_range_kdtree(tree_m1_, shifted_.data() + i, m_ + 1, r);
+    }
+
+    A -= (N - m_);
+    B -= (N - m_);
+
+    vector<long long> result(2);
+    result[0] = A;
+    result[1] = B;
+    return result;
+}
+
+void SampenIndexKDG::CountTemplate(unsigned i, int r, 
+                                   long long *a, long long *b) const
+{
+    *a += count_range_kdtree(tree_m_, shifted_.data() + i, m_, r);
+    *b += count_range_kdtree(tree_m1_, shifted_.data() + i, m_ + 1, r);
+}
+
+vector<long long> SampenIndexWT::ComputeAB(int r) const
+{
+    long long A = 0, B = 0;
+    unsigned n = tree_.size();
+    for (unsigned i = 0; i < n; i++)
+    {
+        tree_.CountAB(data_.data() + i, r, &A, &B);
+    }
+
+    A -= n;
+    B -= n;
+
+    vector<long long> result(2);
+    result[0] = A;
+    result[1] = B;
+    return result;
+}
+
+SampenIndexSweep::SampenIndexSweep(const vector<int> &data, unsigned m)
+    : SampenIndex(data, m), n_(data.size() - m)
+{
+    if (m == 0)
+        throw std::invalid_argument("m == 0");
+    vector<unsigned> order = SortTemplates(data_, 1, n_);
+    coords_.resize(static_cast<size_t>(m + 1) * n_);
+    for (unsigned d = 0; d <= m; d++)
+    {
+        for (unsigned k = 0; k < n_; k++)
+            coords_[d * n_ + k] = data_[order[k] + d];
+    }
+}
+
+void SampenIndexSweep::CountTemplate(unsigned i, int r, 
+                                     long long *a, long long *b) const
+{
+    const int *q = data_.data() + i;
+    const int *keys = coords_.data();
+    unsigned begin = std::lower_bound(keys, keys + n_, q[0] - r) - keys;
+    unsigned end = std::upper_bound(keys + begin, keys + n_, q[0] + r) - keys;
+    // The first coordinates are within r by the range of the sorted order
+    CountMatchedBlocks(coords_.data(), n_, q, 1, 1, m_, r, begin, end, a, b);
+}
+
+// Each pair is found once from its smaller position in the sorted order, 
+// and counted twice to agree with the other indices
+vector<long long> SampenIndexSweep::ComputeAB(int r) const
+{
+    long long A = 0, B = 0;
+    const int *keys = coords_.data();
+    vector<int> q(m_ + 1);
+    unsigned end = 0;
+    for (unsigned k = 0; k < n_; k++)
+    {
+        while (end < n_ && keys[end] <= keys[k] + r) end++;
+        for (unsigned d = 0; d <= m_; d++)
+            q[d] = coords_[d * n_ + k];
+        CountMatchedBlocks(coords_.data(), n_, q.data(), 1, 1, m_, r, 
+                           k + 1, end, &A, &B);
+    }
+
+    vector<long long> result(2);
+    result[0] = 2 * A;
+    result[1] = 2 * B;
+    return result;
+}
@@ -0,0 +1,151 @@
+/* file: sampen_index.h
+ * date: 2026-10-19
+ * author: phree
+ *
+ * description: index structures built once for a pair (data, m) and then
+ *   queried for A and B with different r
+ */
+
+#ifndef __SAMPEN_INDEX_H__
+#define __SAMPEN_INDEX_H__
+
+#include <vector>
+#include <memory>
+
+#include "utils.h"
+#include "kdtree.h"
+#include "wide_tree.h"
+
+using std::vector;
+using std::shared_ptr;
+
+// base class of the indices built on the templates of a record
+class SampenIndex
+{
+public:
+    SampenIndex(const vector<int> &data, unsigned m) : data_(data), m_(m)
+    {
+        if (data.size() <= m)
+            throw std::invalid_argument("data.size() < m");
+    }
+    virtual ~SampenIndex() = default;
+    // Whether this index is built on data with template length m
+    bool Match(const vector<int> &data, unsigned m) const
+    {
+        return m == m_ && data == data_;
+    }
+    unsigned m() const { return m_; }
+    const vector<int> &data() const { return data_; }
+    // Count A and B with tolerance r; no rebuild is needed for a new r
+    virtual vector<long long> ComputeAB(int r) const = 0;
+    /*
+     * Count the templates within distance r of the i-th template, itself 
+     * included, over the first m coordinates (a) and all m + 1 coordinates 
+     * (b), 0 <= i < data.size() - m.
+     */
+    virtual void CountTemplate(unsigned i, int r, 
+                               long long *a, long long *b) const = 0;
+protected:
+    vector<int> data_;
+    unsigned m_;
+};
+
+// range tree over the templates of length m and m + 1
+class SampenIndexRT : public SampenIndex
+{
+public:
+    SampenIndexRT(const vector<int> &data, unsigned m);
+    virtual vector<long long> ComputeAB(int r) const override;
+    virtual void CountTemplate(unsigned i, int r, 
+                               long long *a, long long *b) const override;
+private:
+    vector<Point> points_;
+    shared_ptr<RT::RangeTree<int, int> > tree_m_;
+    shared_ptr<RT::RangeTree<int, int> > tree_m1_;
+};
+
+// old kd tree divided by data points
+class SampenIndexKD : public SampenIndex
+{
+public:
+    SampenIndexKD(const vector<int> &data, unsigned m);
+    ~SampenIndexKD();
+    SampenIndexKD(const SampenIndexKD &) = delete;
+    SampenIndexKD &operator=(const SampenIndexKD &) = delete;
+    virtual vector<long long> ComputeAB(int r) const override;
+    virtual void CountTemplate(unsigned i, int r, 
+                               long long *a, long long *b) const override;
+    /*
+     * Approximate A and B, nodes with no more than max_nump points are not 
+     * descended (see count_range_kdtree_approx). Every stride-th query is 
+     * also counted exactly to correct the bias of the approximation, and 
+     * the variances of A and B are returned in var_a and var_b.
+     */
+    vector<double> ComputeABApprox(int r, unsigned max_nump, unsigned stride,
+                                   double *var_a, double *var_b) const;
+private:
+    struct kdtree *tree_m_;
+    struct kdtree *tree_m1_;
+};
+
+// kd tree divided according to grid
+class SampenIndexKDG : public SampenIndex
+{
+public:
+    SampenIndexKDG(const vector<int> &data, unsigned m);
+    ~SampenIndexKDG();
+    SampenIndexKDG(const SampenIndexKDG &) = delete;
+    SampenIndexKDG &operator=(const SampenIndexKDG &) = delete;
+    virtual vector<long long> ComputeAB(int r) const override;
+    virtual void CountTemplate(unsigned i, int r, 
+                               long long *a, long long *b) const override;
+    // The depth of the grid covering [0, max - min]
+    static unsigned GridDepth(long long range);
+private:
+    struct kdtree *tree_m_;
+    struct kdtree *tree_m1_;
+    // The data minus its minimum, which the grid assumes non-negative
+    vector<int> shifted_;
+};
+
+// wide bounding volume tree with bucketed leaves
+class SampenIndexWT : public SampenIndex
+{
+public:
+    SampenIndexWT(const vector<int> &data, unsigned m)
+        : SampenIndex(data, m), tree_(data, m + 1, data.size() - m) {}
+    virtual vector<long long> ComputeAB(int r) const override;
+    virtual void CountTemplate(unsigned i, int r, 
+                               long long *a, long long *b) const override
+    {
+        tree_.CountAB(data_.data() + i, r, a, b);
+    }
+private:
+    WideTree tree_;
+};
+
+// templates sorted by the first coordinate, a query scans the templates 
+// whose first coordinates are within r of its own
+class SampenIndexSweep : public SampenIndex
+{
+public:
+    SampenIndexSweep(const vector<int> &data, unsigned m);
+    virtual vector<long long> ComputeAB(int r) const override;
+    virtual void CountTemplate(unsigned i, int r, 
+                               long long *a, long long *b) const override;
+private:
+    // The number of templates
+    unsigned n_;
+    // Coordinates in the sorted order, coords_[d * n_ + k]
+    vector<int> coords_;
+};
+
+/*
+ * Count the points within [p - r, p + r] for each point p in points using a
+ * range tree built on points, only the first m coordinates are used.
+ */
+long long CountPointsRT(const RT::RangeTree<int, int> &rtree,
+                        const vector<Point> &points,
+                        const unsigned m, const int r);
+
+#endif // __SAMPEN_INDEX_H__
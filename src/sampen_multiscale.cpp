@@ -0,0 +1,121 @@
+/* file: sampen_multiscale.cpp
+ * date: 2026-10-19
+ * author: phree
+ *
+ * description: implementation of multiscale sample entropy
+ */
+#include <algorithm>
+#include <atomic>
+#include <limits.h>
+#include <math.h>
+#include <stdexcept>
+#include <thread>
+
+#include "sampen_multiscale.h"
+#include "sampen_planner.h"
+#include "utils.h"
+
+vector<MultiscaleEntropy> ComputeMultiscaleEntropy(
+    const vector<int> &data, unsigned m, int r, unsigned max_scale, 
+    bool composite)
+{
+    if (max_scale == 0)
+        throw std::invalid_argument("max_scale == 0");
+    if (r < 0)
+        throw std::invalid_argument("r < 0");
+    if (data.empty())
+        throw std::invalid_argument("data is empty");
+    const unsigned N = data.size();
+    long long max_abs = 0;
+    for (int x : data)
+        max_abs = std::max(max_abs, std::abs(static_cast<long long>(x)));
+    // The engines compute x +- r tau and x - y in int for the sums x, y
+    if ((max_abs + r) * max_scale > INT_MAX / 2)
+        throw std::invalid_argument("the coarse-grained series overflow");
+    vector<long long> prefix(N + 1, 0);
+    for (unsigned k = 0; k < N; k++)
+        prefix[k + 1] = prefix[k] + data[k];
+
+    // One job for each series (scale, offset), longest first
+    struct Job
+    {
+        unsigned scale;
+        unsigned offset;
+        unsigned length;
+        double sampen;
+        double a;
+        double b;
+    };
+    vector<Job> jobs;
+    for (unsigned scale = 1; scale <= max_scale; scale++)
+    {
+        unsigned num_offsets = composite ? scale : 1;
+        for (unsigned offset = 0; offset < num_offsets; offset++)
+        {
+            unsigned length = offset < N ? (N - offset) / scale : 0;
+            jobs.push_back({scale, offset, length, NAN, 0, 0});
+        }
+    }
+    vector<unsigned> order(jobs.size());
+    for (unsigned k = 0; k < order.size(); k++) order[k] = k;
+    std::stable_sort(order.begin(), order.end(), 
+        [&](unsigned x, unsigned y) { return jobs[x].length > jobs[y].length; });
+
+    auto run = [&](Job &job)
+    {
+        if (job.length < m + 2) return;
+        vector<int> series(job.length);
+        for (unsigned j = 0; j < job.length; j++)
+        {
+            unsigned begin = job.offset + j * job.scale;
+            series[j] = static_cast<int>(
+                prefix[begin + job.scale] - prefix[begin]);
+        }
+        SampenCalculatorAuto sc;
+        job.sampen = sc.ComputeEntropy(series, m, r * job.scale, 
+                                       &job.a, &job.b);
+    };
+    // The engines of the long series use all the threads themselves
+    const unsigned kParallelLength = 1 << 15;
+    unsigned first_short = 0;
+    while (first_short < order.size() && 
+           jobs[order[first_short]].length >= kParallelLength)
+        run(jobs[order[first_short++]]);
+    std::atomic<unsigned> next(first_short);
+    auto worker = [&]()
+    {
+        unsigned k;
+        while ((k = next.fetch_add(1)) < order.size())
+            run(jobs[order[k]]);
+    };
+    const unsigned num_threads = std::max(std::min(
+        GetNumThreads(), static_cast<unsigned>(order.size()) - first_short), 
+        1u);
+    vector<std::thread> threads;
+    for (unsigned t = 1; t < num_threads; t++)
+        threads.push_back(std::thread(worker));
+    worker();
+    for (auto &thread : threads) thread.join();
+
+    // The jobs are in the order of the scales and the offsets
+    vector<MultiscaleEntropy> results(max_scale);
+    unsigned k = 0;
+    for (unsigned scale = 1; scale <= max_scale; scale++)
+    {
+        MultiscaleEntropy &result = results[scale - 1];
+        unsigned num_offsets = composite ? scale : 1;
+        result.scale = scale;
+        result.mse = jobs[k].sampen;
+        double sum = 0, A = 0, B = 0;
+        for (unsigned offset = 0; offset < num_offsets; offset++, k++)
+        {
+            sum += jobs[k].sampen;
+            A += jobs[k].a;
+            B += jobs[k].b;
+        }
+        result.cmse = sum / num_offsets;
+        result.rcmse = (A > 0 && B > 0) ? -log(B / A) : 
+            (std::isnan(sum) ? NAN : INFINITY);
+    }
+    return results;
+}
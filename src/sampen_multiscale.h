@@ -0,0 +1,46 @@
+/* file: sampen_multiscale.h
+ * date: 2026-10-19
+ * author: phree
+ *
+ * description: multiscale sample entropy, i.e., sample entropy of the 
+ *   coarse-grained series of a record at the scales 1, 2, ..., max_scale.
+ */
+
+#ifndef __SAMPEN_MULTISCALE_H__
+#define __SAMPEN_MULTISCALE_H__
+
+#include <vector>
+
+using std::vector;
+
+// Multiscale sample entropy of one scale tau
+struct MultiscaleEntropy
+{
+    unsigned scale;
+    // SampEn of the coarse-grained series starting at the first sample
+    double mse;
+    // The mean of SampEn over the tau series starting at the first tau 
+    // samples (composite MSE), and SampEn of their summed A and B (refined 
+    // composite MSE)
+    double cmse;
+    double rcmse;
+};
+
+/*
+ * Compute the multiscale sample entropy for the scales 1, ..., max_scale. 
+ * The coarse-grained series are the sums of tau samples instead of their 
+ * means, compared with the tolerance r * tau, so that they stay integers 
+ * and the result is the same as with the means and r. r is usually 
+ * computed from the standard deviation of the original record. The series 
+ * are built from the prefix sums of the record, and each one is computed 
+ * by the method chosen by SampenPlanner; the short series run concurrently 
+ * and the long ones one by one with the threads of their engines. The 
+ * entropies of the series shorter than m + 2 are NAN.
+ *
+ * @param composite: also compute cmse and rcmse, otherwise they are mse
+ */
+vector<MultiscaleEntropy> ComputeMultiscaleEntropy(
+    const vector<int> &data, unsigned m, int r, unsigned max_scale, 
+    bool composite = true);
+
+#endif // __SAMPEN_MULTISCALE_H__
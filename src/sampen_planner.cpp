@@ -0,0 +1,484 @@
+/* file: sampen_planner.cpp
+ * date: 2026-10-19
+ * author: phree
+ *
+ * description: implementation of the planner of the methods to compute
+ *   sample entropy
+ */
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <math.h>
+
+#include "sampen_exact.h"
+#include "sampen_planner.h"
+
+const char *MethodName(SampenPlan::method_type method)
+{
+    switch (method)
+    {
+    case SampenPlan::DIRECT: return "direct";
+    case SampenPlan::SWEEP: return "sweep";
+    case SampenPlan::WIDE_TREE: return "wide tree";
+    case SampenPlan::KD_TREE: return "kd tree";
+    case SampenPlan::KD_TREE_GRID: return "kd tree (grid)";
+    case SampenPlan::RANGE_TREE: return "range tree";
+    case SampenPlan::QUERY_SAMPLING: return "query sampling";
+    case SampenPlan::EQUALITY: return "equality";
+    }
+    return "unknown";
+}
+
+SampenCostModel SampenCostModel::Default()
+{
+    SampenCostModel model;
+    model.direct_pair = 1.0e-9;
+    model.sweep_sort = 4.0e-8;
+    model.sweep_scan = 8.0e-10;
+    model.wide_tree_build = 8.0e-9;
+    model.wide_tree_query = 4.5e-8;
+    model.wide_tree_match = 2.0e-10;
+    model.kd_tree_build = 1.5e-7;
+    model.kd_tree_query = 2.5e-7;
+    model.kd_tree_match = 3.0e-10;
+    model.kd_tree_grid_build = 1.9e-7;
+    model.kd_tree_grid_query = 9.5e-7;
+    model.kd_tree_grid_match = 2.8e-9;
+    model.range_tree_build = 2.5e-7;
+    model.range_tree_query = 4.5e-8;
+    return model;
+}
+
+// Pointers to the constants with their names in the calibration file
+static std::map<string, double *> _Fields(SampenCostModel &model)
+{
+    std::map<string, double *> fields;
+    fields["direct_pair"] = &model.direct_pair;
+    fields["sweep_sort"] = &model.sweep_sort;
+    fields["sweep_scan"] = &model.sweep_scan;
+    fields["wide_tree_build"] = &model.wide_tree_build;
+    fields["wide_tree_query"] = &model.wide_tree_query;
+    fields["wide_tree_match"] = &model.wide_tree_match;
+    fields["kd_tree_build"] = &model.kd_tree_build;
+    fields["kd_tree_query"] = &model.kd_tree_query;
+    fields["kd_tree_match"] = &model.kd_tree_match;
+    fields["kd_tree_grid_build"] = &model.kd_tree_grid_build;
+    fields["kd_tree_grid_query"] = &model.kd_tree_grid_query;
+    fields["kd_tree_grid_match"] = &model.kd_tree_grid_match;
+    fields["range_tree_build"] = &model.range_tree_build;
+    fields["range_tree_query"] = &model.range_tree_query;
+    return fields;
+}
+
+bool SampenCostModel::Load(const string &filename)
+{
+    std::ifstream fin(filename);
+    if (!fin) return false;
+    SampenCostModel model = *this;
+    std::map<string, double *> fields = _Fields(model);
+    string name;
+    double value;
+    while (fin >> name >> value)
+    {
+        auto it = fields.find(name);
+        if (it == fields.end() || !(value > 0)) return false;
+        *it->second = value;
+    }
+    if (!fin.eof()) return false;
+    *this = model;
+    return true;
+}
+
+bool SampenCostModel::Save(const string &filename) const
+{
+    std::ofstream fout(filename);
+    if (!fout) return false;
+    SampenCostModel model = *this;
+    fout.precision(6);
+    for (auto &field : _Fields(model))
+        fout << field.first << " " << *field.second << "\n";
+    return static_cast<bool>(fout);
+}
+
+// Match probabilities of the templates and the variance of the queries,
+// estimated from a pilot sample
+struct _PilotStats
+{
+    // Probabilities that a pair matches on the first coordinate, on the
+    // first m coordinates and on all m + 1 coordinates
+    double p1;
+    double pa;
+    double pb;
+    double sampen;
+    // The variance of sampen estimated from one query
+    double query_variance;
+};
+
+static _PilotStats _Pilot(const vector<int> &data, unsigned m, int r,
+                          bool with_queries)
+{
+    const unsigned kPairs = 8192, kQueries = 32;
+    unsigned n = data.size() - m;
+    auto within = [r](int x, int y) { return x - y <= r && y - x <= r; };
+
+    _PilotStats stats;
+    Philox4x32 eng(0, 0);
+    unsigned c1 = 0, ca = 0, cb = 0;
+    for (unsigned k = 0; k < kPairs; k++)
+    {
+        unsigned i = static_cast<unsigned>(RandomBounded(eng, n));
+        unsigned j = static_cast<unsigned>(RandomBounded(eng, n));
+        const int *x = data.data() + i, *y = data.data() + j;
+        unsigned d = 0;
+        while (d <= m && within(x[d], y[d])) d++;
+        c1 += (d >= 1);
+        ca += (d >= m);
+        cb += (d > m);
+    }
+    // Half a pair when none is found
+    stats.p1 = std::max(c1, 1u) / (kPairs + 1.);
+    stats.pa = std::max(ca, 1u) / (kPairs + 1.);
+    stats.pb = std::max(cb, 1u) / (kPairs + 1.);
+    stats.sampen = -log(stats.pb / stats.pa);
+    stats.query_variance = INFINITY;
+    if (!with_queries) return stats;
+
+    // Evenly spaced queries counted exactly
+    vector<long long> AB(2 * kQueries, 0);
+    for (unsigned k = 0; k < kQueries; k++)
+    {
+        const int *x = data.data() + (2 * k + 1) * (n / (2 * kQueries));
+        for (unsigned j = 0; j < n; j++)
+        {
+            const int *y = data.data() + j;
+            unsigned d = 0;
+            while (d <= m && within(x[d], y[d])) d++;
+            AB[2 * k] += (d >= m);
+            AB[2 * k + 1] += (d > m);
+        }
+        AB[2 * k]--;
+        AB[2 * k + 1]--;
+    }
+    long long A = 0, B = 0;
+    for (unsigned k = 0; k < kQueries; k++)
+    {
+        A += AB[2 * k];
+        B += AB[2 * k + 1];
+    }
+    if (A > 0 && B > 0)
+        stats.sampen = -log(static_cast<double>(B) / A);
+    stats.query_variance = ComputeSampenVariance(AB) * kQueries;
+    return stats;
+}
+
+SampenPlan SampenPlanner::Plan(const vector<int> &data, unsigned m, int r,
+                               double rel_err) const
+{
+    if (data.size() <= m + 1)
+        throw std::invalid_argument("data.size() < m + 2");
+    const double n = data.size() - m;
+    if (r == 0)
+    {
+        SampenPlan plan;
+        plan.method = SampenPlan::EQUALITY;
+        plan.time = model_.sweep_sort * n;
+        plan.memory = 32 * n;
+        plan.sample_size = 0;
+        plan.log = "plan for N = " + std::to_string(data.size()) + 
+            ", m = " + std::to_string(m) + ", r = 0\n  chosen: " + 
+            MethodName(plan.method) + "\n";
+        return plan;
+    }
+    const double L = std::max(log2(n), 1.);
+    const double T = GetNumThreads();
+    const double dim = m + 1;
+    const _PilotStats stats = _Pilot(data, m, r, rel_err > 0);
+    const double matches = stats.pa * n;
+
+    struct Candidate
+    {
+        SampenPlan::method_type method;
+        double time;
+        double memory;
+    };
+    vector<Candidate> candidates;
+    candidates.push_back({SampenPlan::DIRECT,
+        model_.direct_pair * n * n / 2 / T, 4 * (dim + 1) * n});
+    const double sweep_build = model_.sweep_sort * n;
+    const double sweep_memory = 4 * dim * n + 12 * n;
+    if (m > 0)
+    {
+        candidates.push_back({SampenPlan::SWEEP,
+            sweep_build + model_.sweep_scan * stats.p1 * n * n / 2,
+            sweep_memory});
+    }
+    candidates.push_back({SampenPlan::WIDE_TREE,
+        model_.wide_tree_build * n * L + n * (
+            model_.wide_tree_query * L + model_.wide_tree_match * matches),
+        4 * (dim + 2) * n + n / 112 * (64 * dim + 64)});
+    candidates.push_back({SampenPlan::KD_TREE,
+        model_.kd_tree_build * n * L + n * (
+            model_.kd_tree_query * L + model_.kd_tree_match * matches),
+        4 * n * (72 + 8 * dim)});
+    int max_ = *std::max_element(data.cbegin(), data.cend());
+    int min_ = *std::min_element(data.cbegin(), data.cend());
+    const long long range = static_cast<long long>(max_) - min_;
+    if (range > 0 && range < (1LL << 30))
+    {
+        // The grid tree shifts the data to [0, max - min]
+        double p = SampenIndexKDG::GridDepth(range);
+        candidates.push_back({SampenPlan::KD_TREE_GRID,
+            model_.kd_tree_grid_build * n * p + n * (
+                model_.kd_tree_grid_query * p + 
+                model_.kd_tree_grid_match * matches),
+            2 * n * p * (72 + 8 * dim)});
+    }
+    if (m > 0)
+    {
+        double Lm = pow(L, m);
+        candidates.push_back({SampenPlan::RANGE_TREE,
+            (model_.range_tree_build + model_.range_tree_query) * n * Lm,
+            80 * n * (Lm / L + Lm)});
+    }
+
+    unsigned sample_size = 0;
+    if (rel_err > 0 && m > 0 && std::isfinite(stats.query_variance))
+    {
+        // Queries for a 95% confidence interval within rel_err * sampen
+        double half = rel_err * std::max(stats.sampen, 1e-3) / 1.96;
+        // At least one query per round, also when the pilot variance is 0, 
+        // e.g., for periodic signals
+        double queries = std::min(std::max(
+            ceil(stats.query_variance / (half * half)), 8.), n);
+        sample_size = static_cast<unsigned>(ceil(queries / 8));
+        if (sample_size > 0)
+        {
+            candidates.push_back({SampenPlan::QUERY_SAMPLING,
+                sweep_build + model_.sweep_scan * stats.p1 * n * queries / T,
+                sweep_memory});
+        }
+    }
+
+    std::ostringstream log;
+    log << "plan for N = " << data.size() << ", m = " << m;
+    log << ", r = " << r << ", rel_err = " << rel_err << "\n";
+    log << "  pilot: p1 = " << stats.p1 << ", pA = " << stats.pa;
+    log << ", pB = " << stats.pb << "\n";
+    const Candidate *best = nullptr, *smallest = nullptr;
+    for (const Candidate &c : candidates)
+    {
+        bool fits = c.memory <= memory_budget_;
+        log << "  " << MethodName(c.method) << ": " << c.time << " s, ";
+        log << c.memory / 1e6 << " MB" << (fits ? "" : " (over budget)");
+        if (c.method == SampenPlan::QUERY_SAMPLING)
+            log << ", " << 8 * sample_size << " queries";
+        log << "\n";
+        if (fits && (!best || c.time < best->time)) best = &c;
+        if (!smallest || c.memory < smallest->memory) smallest = &c;
+    }
+    if (!best)
+    {
+        log << "  no method fits the memory budget\n";
+        best = smallest;
+    }
+    log << "  chosen: " << MethodName(best->method) << "\n";
+
+    SampenPlan plan;
+    plan.method = best->method;
+    plan.time = best->time;
+    plan.memory = best->memory;
+    plan.sample_size = sample_size;
+    plan.log = log.str();
+    return plan;
+}
+
+// Seconds taken by f
+static double _Seconds(const std::function<void()> &f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> interval =
+        std::chrono::steady_clock::now() - start;
+    return std::max(interval.count(), 1e-9);
+}
+
+/*
+ * Fit t = n (c_query * depth + c_match * matches) to the times t_1 and t_2 
+ * of the queries with a small and a large r.
+ */
+static void _FitQuery(double n, double depth, 
+                      double t_1, double matches_1, 
+                      double t_2, double matches_2, 
+                      double *c_query, double *c_match)
+{
+    double y_1 = t_1 / n, y_2 = t_2 / n;
+    *c_match = (matches_2 > matches_1) ? 
+        (y_2 - y_1) / (matches_2 - matches_1) : 0;
+    *c_match = std::max(*c_match, 1e-12);
+    *c_query = std::max((y_1 - *c_match * matches_1) / depth, 1e-12);
+}
+
+SampenCostModel SampenCostModel::Calibrate()
+{
+    // A random walk, which has the local structure of physiological records
+    const unsigned N = 1 << 14, m = 2;
+    vector<int> data(N);
+    Philox4x32 eng(0, 0);
+    int x = 1 << 20;
+    for (unsigned i = 0; i < N; i++)
+    {
+        x += static_cast<int>(RandomBounded(eng, 201)) - 100;
+        data[i] = x;
+    }
+    int min_ = *std::min_element(data.cbegin(), data.cend());
+    for (unsigned i = 0; i < N; i++)
+        data[i] -= min_;
+    // The tree queries are timed with a small and a large r
+    const double sd = sqrt(ComputeVarience(data));
+    const int r_1 = std::max(static_cast<int>(0.02 * sd), 1);
+    const int r_2 = std::max(static_cast<int>(0.2 * sd), r_1 + 1);
+
+    const double n = N - m;
+    const double L = log2(n);
+    const _PilotStats stats_1 = _Pilot(data, m, r_1, false);
+    const _PilotStats stats_2 = _Pilot(data, m, r_2, false);
+    const double matches_1 = stats_1.pa * n, matches_2 = stats_2.pa * n;
+    SampenCostModel model;
+
+    TemplateBuffer templates;
+    vector<unsigned> indices(N - m);
+    for (unsigned i = 0; i < N - m; i++)
+        indices[i] = i;
+    templates.Gather(data, indices, m + 1);
+    long long A = 0, B = 0;
+    model.direct_pair = _Seconds([&]()
+        { CountMatchedFlat(templates, r_2, 0, 1, &A, &B); }) / (n * n / 2);
+
+    shared_ptr<SampenIndex> index;
+    model.sweep_sort = _Seconds([&]()
+        { index = std::make_shared<SampenIndexSweep>(data, m); }) / n;
+    model.sweep_scan = _Seconds([&]() { index->ComputeAB(r_2); }) /
+        (stats_2.p1 * n * n / 2);
+
+    model.wide_tree_build = _Seconds([&]()
+        { index = std::make_shared<SampenIndexWT>(data, m); }) / (n * L);
+    _FitQuery(n, L, 
+              _Seconds([&]() { index->ComputeAB(r_1); }), matches_1, 
+              _Seconds([&]() { index->ComputeAB(r_2); }), matches_2, 
+              &model.wide_tree_query, &model.wide_tree_match);
+
+    model.kd_tree_build = _Seconds([&]()
+        { index = std::make_shared<SampenIndexKD>(data, m); }) / (n * L);
+    _FitQuery(n, L, 
+              _Seconds([&]() { index->ComputeAB(r_1); }), matches_1, 
+              _Seconds([&]() { index->ComputeAB(r_2); }), matches_2, 
+              &model.kd_tree_query, &model.kd_tree_match);
+
+    // The same depth as the index and Plan, at least 1 for constant data
+    int max_ = *std::max_element(data.cbegin(), data.cend());
+    min_ = *std::min_element(data.cbegin(), data.cend());
+    double p = std::max(SampenIndexKDG::GridDepth(
+        static_cast<long long>(max_) - min_), 1u);
+    model.kd_tree_grid_build = _Seconds([&]()
+        { index = std::make_shared<SampenIndexKDG>(data, m); }) / (n * p);
+    _FitQuery(n, p, 
+              _Seconds([&]() { index->ComputeAB(r_1); }), matches_1, 
+              _Seconds([&]() { index->ComputeAB(r_2); }), matches_2, 
+              &model.kd_tree_grid_query, &model.kd_tree_grid_match);
+
+    // The range tree is slow to build, so a shorter record is used
+    const unsigned N_rt = 1 << 12;
+    vector<int> data_rt(data.begin(), data.begin() + N_rt);
+    const double n_rt = N_rt - m;
+    const double Lm = pow(log2(n_rt), m);
+    model.range_tree_build = _Seconds([&]()
+        { index = std::make_shared<SampenIndexRT>(data_rt, m); }) /
+        (n_rt * Lm);
+    model.range_tree_query = _Seconds([&]() { index->ComputeAB(r_2); }) /
+        (n_rt * Lm);
+    return model;
+}
+
+double SampenCalculatorAuto::ComputeEntropy(
+    const vector<int> &data, unsigned m, int r, double *a, double *b)
+{
+    _CheckDim(data, m);
+    plan_ = planner_.Plan(data, m, r, rel_err_);
+    if (log_) *log_ << plan_.log;
+
+    if (plan_.method == SampenPlan::QUERY_SAMPLING)
+    {
+        SampenCalculatorQuery sc(8, plan_.sample_size);
+        SequentialReport report;
+        double sampen = sc.ComputeEntropySequential(
+            data, m, r, rel_err_, 0.95, 64, &report);
+        if (log_)
+        {
+            *log_ << "  rounds: " << report.rounds << ", interval: [";
+            *log_ << report.lower << ", " << report.upper << "]\n";
+        }
+        // Scale the matches of the queries to all pairs
+        double scale = (data.size() - m) / 2. / report.sample_size;
+        if (a) *a = report.a * scale;
+        if (b) *b = report.b * scale;
+        return sampen;
+    }
+
+    vector<long long> AB = _ComputeAB(data, m, r);
+    if (a) *a = AB[0];
+    if (b) *b = AB[1];
+    return ComputeSampenAB(AB[0], AB[1], data.size(), m);
+}
+
+vector<long long> SampenCalculatorAuto::_ComputeAB(
+    const vector<int> &data, unsigned m, int r)
+{
+    shared_ptr<SampenIndex> index;
+    switch (plan_.method)
+    {
+    case SampenPlan::DIRECT:
+    {
+        TemplateBuffer templates;
+        vector<unsigned> indices(data.size() - m);
+        for (unsigned i = 0; i < indices.size(); i++)
+            indices[i] = i;
+        templates.Gather(data, indices, m + 1);
+        ABCalculatorFlatD ABc;
+        return ABc.ComputeAB(templates, r);
+    }
+    case SampenPlan::EQUALITY:
+        return CountABEqual(data, m);
+    case SampenPlan::SWEEP:
+    case SampenPlan::QUERY_SAMPLING:
+        index = std::make_shared<SampenIndexSweep>(data, m);
+        break;
+    case SampenPlan::WIDE_TREE:
+        index = std::make_shared<SampenIndexWT>(data, m);
+        break;
+    case SampenPlan::KD_TREE:
+        index = std::make_shared<SampenIndexKD>(data, m);
+        break;
+    case SampenPlan::KD_TREE_GRID:
+        index = std::make_shared<SampenIndexKDG>(data, m);
+        break;
+    case SampenPlan::RANGE_TREE:
+        index = std::make_shared<SampenIndexRT>(data, m);
+        break;
+    }
+    // The indices count each pair twice
+    vector<long long> AB = index->ComputeAB(r);
+    AB[0] /= 2;
+    AB[1] /= 2;
+    return AB;
+}
+
+double ComputeSampenAuto(
+    const vector<int> &data, unsigned m, int r, double rel_err,
+    double *a, double *b)
+{
+    SampenCalculatorAuto sc(rel_err);
+    return sc.ComputeEntropy(data, m, r, a, b);
+}
@@ -0,0 +1,127 @@
+/* file: sampen_planner.h
+ * date: 2026-10-19
+ * author: phree
+ *
+ * description: choose the method to compute sample entropy from the cost
+ *   of building and querying each engine, which is estimated from N, m, a
+ *   pilot sample of the template pairs and constants calibrated locally.
+ */
+
+#ifndef __SAMPEN_PLANNER_H__
+#define __SAMPEN_PLANNER_H__
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sampen_calculator.h"
+
+using std::string;
+using std::vector;
+
+// Seconds per unit of work of each engine
+struct SampenCostModel
+{
+    // A pair of templates compared by the direct method
+    double direct_pair;
+    // A template sorted and a template scanned by the sweep
+    double sweep_sort;
+    double sweep_scan;
+    // Build per n log n, query per log n, and per matched template
+    double wide_tree_build;
+    double wide_tree_query;
+    double wide_tree_match;
+    double kd_tree_build;
+    double kd_tree_query;
+    double kd_tree_match;
+    // Build per n p, query per p, and per matched template, where p is the 
+    // depth of the grid, i.e., log2 of the range of the data
+    double kd_tree_grid_build;
+    double kd_tree_grid_query;
+    double kd_tree_grid_match;
+    // Build per n log^m n, query per log^m n
+    double range_tree_build;
+    double range_tree_query;
+
+    // Constants calibrated with a release build on one core of a server
+    static SampenCostModel Default();
+    // Time each engine on a synthetic record, which takes a few seconds
+    static SampenCostModel Calibrate();
+    // Read and write the constants as "name value" lines
+    bool Load(const string &filename);
+    bool Save(const string &filename) const;
+};
+
+// The method chosen by the planner with its estimated cost
+struct SampenPlan
+{
+    enum method_type {DIRECT, SWEEP, WIDE_TREE, KD_TREE, KD_TREE_GRID,
+                      RANGE_TREE, QUERY_SAMPLING, EQUALITY};
+    method_type method;
+    // Estimated seconds and peak bytes
+    double time;
+    double memory;
+    // The queries of each round of QUERY_SAMPLING
+    unsigned sample_size;
+    // The costs of all candidates and the reason of the choice
+    string log;
+};
+
+const char *MethodName(SampenPlan::method_type method);
+
+class SampenPlanner
+{
+public:
+    explicit SampenPlanner(
+        const SampenCostModel &model = SampenCostModel::Default(),
+        double memory_budget = 4e9)
+        : model_(model), memory_budget_(memory_budget)
+    {}
+    /*
+     * Choose the fastest method whose peak memory is within the budget.
+     * Only the exact methods are considered when rel_err is 0, otherwise
+     * query sampling is also considered, with enough queries for a 95%
+     * confidence interval within rel_err * sampen. For r = 0 the identical 
+     * templates are counted by hashing in linear time.
+     */
+    SampenPlan Plan(const vector<int> &data, unsigned m, int r,
+                    double rel_err) const;
+    void set_memory_budget(double memory_budget)
+    {
+        memory_budget_ = memory_budget;
+    }
+private:
+    SampenCostModel model_;
+    double memory_budget_;
+};
+
+// Compute sample entropy by the method chosen by SampenPlanner
+class SampenCalculatorAuto : public SampenCalculator
+{
+public:
+    explicit SampenCalculatorAuto(
+        double rel_err = 0, double memory_budget = 4e9,
+        const SampenCostModel &model = SampenCostModel::Default())
+        : planner_(model, memory_budget), rel_err_(rel_err), log_(nullptr)
+    {}
+    virtual double ComputeEntropy(const vector<int> &data, unsigned m,
+                                  int r, double *a, double *b) override;
+    // The plan of the last computation
+    const SampenPlan &plan() const { return plan_; }
+    // Write the plans to log, nothing is written if log is nullptr
+    void set_log(std::ostream *log) { log_ = log; }
+private:
+    // A and B of the exact methods, each pair is counted once
+    virtual vector<long long> _ComputeAB(const vector<int> &data,
+                                         unsigned m, int r) override;
+    SampenPlanner planner_;
+    SampenPlan plan_;
+    double rel_err_;
+    std::ostream *log_;
+};
+
+double ComputeSampenAuto(
+    const vector<int> &data, unsigned m, int r, double rel_err,
+    double *a, double *b);
+
+#endif // __SAMPEN_PLANNER_H__
@@ -3,7 +3,9 @@
  * author: phree
  *
  * description: This program is used to measure the variance of the 
- *   errors of the entropies computed by sampling method.
+ *   errors of the entropies computed by sampling method. The standard error 
+ *   is estimated from the rounds of one run, repeated runs and the ground 
+ *   truth by the direct method are optional.
  */
 
 #include <iostream>
@@ -25,6 +27,8 @@ struct
     unsigned sample_size = 0;
     unsigned sample_num = 0;
     unsigned rounds = 0;
+    bool ground_truth = false;
+    bool control_variate = false;
 } _status;
 
 void parse_args(int argc, char *argv[])
@@ -64,9 +68,11 @@ void parse_args(int argc, char *argv[])
     if (arg.size()) 
         _status.rounds = std::stoi(arg);
     else 
-        _status.rounds = 20;
-    if (_status.rounds == 1) 
-        throw std::invalid_argument("rounds should be greater than 1");
+        _status.rounds = 1;
+    if (_status.rounds == 0) 
+        throw std::invalid_argument("rounds should be greater than 0");
+    _status.ground_truth = ap.isOption("-truth");
+    _status.control_variate = ap.isOption("-cv");
 }
 
 
@@ -101,35 +107,60 @@ int main(int argc, char *argv[])
     cout.setf(std::ios::fixed, std::ios::floatfield);
     cout.precision(6);
 
-    SampenCalculatorD sc;
-    double ground_truth = sc.ComputeEntropy(
-        data, _status.m, _status.r, nullptr, nullptr);
-    std::cout << "SampleEntropy(" << N << ", " << _status.m << ", " << _status.r;
-    std::cout << ") = " << ground_truth << std::endl;
+    double ground_truth = 0.;
+    if (_status.ground_truth) 
+    {
+        SampenCalculatorD sc;
+        ground_truth = sc.ComputeEntropy(
+            data, _status.m, _status.r, nullptr, nullptr);
+        cout << "SampleEntropy(" << N << ", " << _status.m << ", ";
+        cout << _status.r << ") = " << ground_truth << endl;
+    }
     vector<double> results(_status.rounds);
-    vector<double> errors(_status.rounds);
     for (unsigned i = 0; i < _status.rounds; i++)
     {
-        SampenCalculatorQR sc(sample_num, sample_size, true);
-        results[i] = sc.ComputeEntropy(
-            data, _status.m, _status.r, nullptr, nullptr);
-        
-        errors[i] = results[i] - ground_truth;
-        std::cout << "Sampen: " << results[i] << ", ";
-        std::cout << "Error: " << (errors[i]) / ground_truth << std::endl;
+        SampenEstimate estimate;
+        if (_status.control_variate) 
+        {
+            // The control variates need independent uniform templates
+            SampenCalculatorUniform sc(sample_num, sample_size);
+            estimate = sc.ComputeEstimateCV(data, _status.m, _status.r);
+        }
+        else 
+        {
+            SampenCalculatorQR sc(sample_num, sample_size, true);
+            estimate = sc.ComputeEstimate(data, _status.m, _status.r);
+        }
+        results[i] = estimate.sampen;
+        cout << "Sampen: " << estimate.sampen << ", ";
+        cout << "Standard error: " << estimate.std_error;
+        if (_status.ground_truth) 
+        {
+            cout << ", Error: ";
+            cout << (estimate.sampen - ground_truth) / ground_truth;
+        }
+        cout << endl;
+    }
+    if (_status.rounds > 1) 
+    {
+        double mean = 0.;
+        std::for_each(results.cbegin(), 
+                      results.cend(), 
+                      [&](const double r) { mean += r; });
+        mean /= _status.rounds;
+        double var = 0.;
+        std::for_each(results.cbegin(), 
+                      results.cend(), 
+                      [&](const double r) { var += (r - mean) * (r - mean); });
+        var /= (_status.rounds - 1);
+        cout << "mean: " << mean << endl;
+        if (_status.ground_truth) 
+        {
+            cout << "mean error: " << (mean - ground_truth) / ground_truth;
+            cout << endl;
+        }
+        cout << "The variance is " << var << endl;
     }
-    double mean = 0.;
-    std::for_each(errors.cbegin(), 
-                  errors.cend(), 
-                  [&](const double r) { mean += r; });
-    mean /= _status.rounds * ground_truth;
-    std::cout << "mean: " << mean << std::endl;
-    double var = 0.;
-    std::for_each(results.cbegin(), 
-                  results.cend(), 
-                  [&](const double r) { var += r * r; });
-    var /= (_status.rounds - 1);
-    std::cout << "The variance is " << var << std::endl;
     cout << "+---------------------------------------------------+" << endl;
     cout << "|                  sampen_var ends                  |" << endl;
     cout << "+---------------------------------------------------+" << endl;
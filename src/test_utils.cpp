@@ -1,13 +1,266 @@
 #include <iostream>
+#include <memory>
+#include <random>
 #include <vector>
+#include <math.h>
 
+#include "sampen_calculator.h"
+#include "sampen_exact.h"
+#include "sampen_index.h"
+#include "sampen_multiscale.h"
 #include "utils.h"
 
 using namespace std;
+
+// Compare the grid kd tree with the direct method, which counts each pair 
+// once while the index counts ordered pairs
+bool CheckKDG(const vector<int> &data, unsigned m, int r, const char *name)
+{
+    SampenCalculatorD direct;
+    double a = 0, b = 0;
+    direct.ComputeEntropy(data, m, r, &a, &b);
+    SampenIndexKDG index(data, m);
+    vector<long long> AB = index.ComputeAB(r);
+    bool ok = (AB[0] == 2 * static_cast<long long>(a) && 
+               AB[1] == 2 * static_cast<long long>(b));
+    cout << name << ": " << (ok ? "ok" : "FAILED") << " (A = " << AB[0] / 2;
+    cout << ", B = " << AB[1] / 2 << ", direct " << a << ", " << b << ")";
+    cout << endl;
+    return ok;
+}
+
+// A, B and approximate entropy by comparing all pairs of templates
+struct BruteForce
+{
+    long long a;
+    long long b;
+    double apen;
+};
+
+BruteForce ComputeBruteForce(const vector<int> &data, unsigned m, int r)
+{
+    const unsigned N = data.size();
+    auto matched = [&](unsigned i, unsigned j, unsigned dim)
+    {
+        for (unsigned d = 0; d < dim; d++)
+        {
+            if (abs(data[i + d] - data[j + d]) > r) return false;
+        }
+        return true;
+    };
+    BruteForce result = {0, 0, 0};
+    for (unsigned i = 0; i < N - m; i++)
+    {
+        for (unsigned j = i + 1; j < N - m; j++)
+        {
+            result.a += matched(i, j, m);
+            result.b += matched(i, j, m + 1);
+        }
+    }
+    // phi of dimension dim, the self-matches are counted
+    auto phi = [&](unsigned dim)
+    {
+        const unsigned n = N - dim + 1;
+        double sum = 0;
+        for (unsigned i = 0; i < n; i++)
+        {
+            unsigned count = 0;
+            for (unsigned j = 0; j < n; j++) count += matched(i, j, dim);
+            sum += log(static_cast<double>(count) / n);
+        }
+        return sum / n;
+    };
+    result.apen = phi(m) - phi(m + 1);
+    return result;
+}
+
+// Compare the exact engines with the direct method and the brute force on 
+// small random records with few distinct values
+bool CheckExact()
+{
+    std::mt19937 eng(2026);
+    unsigned cases = 0, failures = 0;
+    for (int num_values : {2, 5, 40})
+    {
+        for (unsigned N : {60u, 300u})
+        {
+            std::uniform_int_distribution<int> value(0, num_values - 1);
+            vector<int> data(N);
+            for (int &x : data) x = value(eng);
+            for (unsigned m = 1; m <= 7; m++)
+            {
+                for (int r : {0, 1, 3})
+                {
+                    BruteForce expected = ComputeBruteForce(data, m, r);
+                    vector<vector<long long> > ABs;
+                    double a = 0, b = 0;
+                    SampenCalculatorD direct;
+                    direct.ComputeEntropy(data, m, r, &a, &b);
+                    ABs.push_back({static_cast<long long>(a), 
+                                   static_cast<long long>(b)});
+                    ABs.push_back(CountABGrid(data, m, r));
+                    if (SampenCalculatorSAT::TableMemory(data, m) < 4e7)
+                        ABs.push_back(CountABSummedArea(data, m, r));
+                    if (m <= 3) 
+                        ABs.push_back(CountABDominance(data, m, r));
+                    ABs.push_back(CountABBitset(data, m, r));
+                    if (r == 0) ABs.push_back(CountABEqual(data, m));
+                    EntropyStatistics stats = 
+                        ComputeEntropyStatistics(data, m, r);
+                    ABs.push_back({stats.a, stats.b});
+                    bool ok = fabs(stats.apen - expected.apen) < 1e-12;
+                    for (const vector<long long> &AB : ABs)
+                        ok &= AB[0] == expected.a && AB[1] == expected.b;
+                    cases++;
+                    if (ok) continue;
+                    failures++;
+                    cout << "  mismatch for " << num_values << " values, N = ";
+                    cout << N << ", m = " << m << ", r = " << r << endl;
+                }
+            }
+        }
+    }
+    cout << "exact engines: " << (failures ? "FAILED" : "ok") << " (";
+    cout << cases - failures << " of " << cases << " cases)" << endl;
+    return failures == 0;
+}
+
+// The estimates of ComputeSweep at each size should be those of 
+// ComputeEstimate with that sample size
+bool CheckSweep()
+{
+    std::mt19937 eng(48);
+    std::uniform_int_distribution<int> value(0, 99);
+    vector<int> data(5000);
+    for (int &x : data) x = value(eng);
+    const vector<unsigned> sizes = {64, 200, 200, 500};
+    bool ok = true;
+    for (int kind = 0; kind < 3; kind++)
+    {
+        const char *names[] = {"QR, presort", "QR", "uniform"};
+        auto make = [&](unsigned size) -> shared_ptr<SampenCalculatorSampling>
+        {
+            if (kind == 2) 
+                return std::make_shared<SampenCalculatorUniform>(8, size);
+            return std::make_shared<SampenCalculatorQR>(8, size, kind == 0);
+        };
+        // The sample size of the calculator is kept by the sweep
+        shared_ptr<SampenCalculatorSampling> sweep = make(100);
+        vector<SampenEstimate> estimates = 
+            sweep->ComputeSweep(data, 2, 10, sizes);
+        bool same = sweep->ComputeEstimate(data, 2, 10).sampen == 
+            make(100)->ComputeEstimate(data, 2, 10).sampen;
+        for (unsigned c = 0; c < sizes.size(); c++)
+        {
+            SampenEstimate expected = 
+                make(sizes[c])->ComputeEstimate(data, 2, 10);
+            same &= estimates[c].a == expected.a && 
+                estimates[c].b == expected.b && 
+                estimates[c].sampen == expected.sampen;
+        }
+        cout << "sweep (" << names[kind] << "): ";
+        cout << (same ? "ok" : "FAILED") << endl;
+        ok &= same;
+    }
+    return ok;
+}
+
+// ComputeMultiscaleEntropy against coarse-grained series built directly 
+// and counted by brute force, for the scales up to 3
+bool CheckMultiscale()
+{
+    const unsigned kMaxScale = 3;
+    std::mt19937 eng(49);
+    std::uniform_int_distribution<int> value(0, 9);
+    auto same = [](double x, double y)
+    {
+        if (std::isnan(x) || std::isnan(y)) 
+            return std::isnan(x) && std::isnan(y);
+        if (std::isinf(x) || std::isinf(y)) return x == y;
+        return fabs(x - y) < 1e-12;
+    };
+    unsigned cases = 0, failures = 0;
+    for (unsigned N : {7, 40, 300})
+    {
+        vector<int> data(N);
+        for (int &x : data) x = value(eng);
+        for (unsigned m = 1; m <= 2; m++)
+        {
+            for (int r = 0; r <= 2; r++)
+            {
+                vector<MultiscaleEntropy> results = 
+                    ComputeMultiscaleEntropy(data, m, r, kMaxScale);
+                bool ok = results.size() == kMaxScale;
+                for (unsigned scale = 1; ok && scale <= kMaxScale; scale++)
+                {
+                    double sum = 0, A = 0, B = 0, mse = NAN;
+                    bool short_series = false;
+                    for (unsigned offset = 0; offset < scale; offset++)
+                    {
+                        vector<int> series;
+                        for (unsigned i = offset; i + scale <= N; i += scale)
+                        {
+                            int x = 0;
+                            for (unsigned k = 0; k < scale; k++) 
+                                x += data[i + k];
+                            series.push_back(x);
+                        }
+                        double sampen = NAN;
+                        if (series.size() >= m + 2)
+                        {
+                            BruteForce expected = 
+                                ComputeBruteForce(series, m, r * scale);
+                            A += expected.a;
+                            B += expected.b;
+                            sampen = ComputeSampenAB(
+                                expected.a, expected.b, series.size(), m);
+                        }
+                        else short_series = true;
+                        if (offset == 0) mse = sampen;
+                        sum += sampen;
+                    }
+                    double rcmse = short_series ? NAN : 
+                        ComputeSampenAB(A, B, N / scale, m);
+                    const MultiscaleEntropy &result = results[scale - 1];
+                    ok &= result.scale == scale && same(result.mse, mse) && 
+                        same(result.cmse, sum / scale) && 
+                        same(result.rcmse, rcmse);
+                }
+                cases++;
+                if (!ok)
+                {
+                    failures++;
+                    cout << "multiscale FAILED: N = " << N << ", m = " << m;
+                    cout << ", r = " << r << endl;
+                }
+            }
+        }
+    }
+    cout << "multiscale: " << (failures ? "FAILED" : "ok") << " (";
+    cout << cases - failures << " of " << cases << " cases)" << endl;
+    return failures == 0;
+}
+
 int main()
 {
     vector<double> data(53453222, 1);
     double sum = ComputeSum(data);
     cout << sum << endl;
-    return 0;
-}
\ No newline at end of file
+
+    bool ok = true;
+    // Data with a positive minimum, as raw RR intervals
+    vector<int> shifted(3000);
+    for (unsigned i = 0; i < shifted.size(); i++)
+        shifted[i] = 500 + (i * 7919) % 301;
+    ok &= CheckKDG(shifted, 2, 5, "kd tree (grid), shifted data");
+    // Range 0..8, whose width is a power of two
+    vector<int> power(3000);
+    for (unsigned i = 0; i < power.size(); i++)
+        power[i] = (i * 7919) % 9;
+    ok &= CheckKDG(power, 1, 1, "kd tree (grid), range of 2^3");
+    ok &= CheckKDG(power, 2, 0, "kd tree (grid), range of 2^3, r = 0");
+    ok &= CheckExact();
+    ok &= CheckSweep();
+    ok &= CheckMultiscale();
+    return ok ? 0 : 1;
+}
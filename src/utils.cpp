@@ -1,8 +1,10 @@
 #include <iostream>
 #include <algorithm>
+#include <thread>
 
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
 #include "utils.h"
 
 using std::cerr;
@@ -19,6 +21,144 @@ vector<Point> GetPoints(const vector<int> &data, unsigned m)
     return result;
 }
 
+unsigned GetNumThreads()
+{
+	unsigned num_threads = std::thread::hardware_concurrency();
+	if (!num_threads) num_threads = 16;
+	else if (num_threads > 12) num_threads -= 8;
+	else num_threads /= 2;
+	return std::max(num_threads, 1u);
+}
+
+void ParallelFor(unsigned n, const std::function<void(unsigned, unsigned)> &f, 
+                 unsigned min_chunk)
+{
+	if (n == 0) return;
+	unsigned num_threads = std::min(GetNumThreads(), 
+		std::max(n / std::max(min_chunk, 1u), 1u));
+	unsigned chunk = (n + num_threads - 1) / num_threads;
+	vector<std::thread> threads;
+	for (unsigned t = 1; t < num_threads; t++)
+	{
+		unsigned begin = std::min(t * chunk, n);
+		threads.push_back(std::thread(f, begin, std::min(begin + chunk, n)));
+	}
+	f(0, std::min(chunk, n));
+	for (auto &thread : threads) thread.join();
+}
+
+// One stable counting sort pass of (keys, perm) by the digit of keys at 
+// shift. Each thread counts and scatters a contiguous chunk, and the 
+// offsets of the chunks follow the chunk order, so the pass is stable.
+// Return false if all keys have the same digit and nothing is moved.
+static bool _RadixPass(vector<uint64_t> &keys, vector<unsigned> &perm, 
+                       vector<uint64_t> &keys_tmp, vector<unsigned> &perm_tmp,
+                       unsigned shift, unsigned num_threads)
+{
+	const unsigned kRadix = 1 << 11;
+	const size_t n = keys.size();
+	const size_t chunk = (n + num_threads - 1) / num_threads;
+	vector<size_t> counts(static_cast<size_t>(num_threads) * kRadix, 0);
+
+	auto count = [&](unsigned t)
+	{
+		size_t *c = counts.data() + t * kRadix;
+		size_t end = std::min(n, (t + 1) * chunk);
+		for (size_t i = t * chunk; i < end; i++)
+			c[(keys[i] >> shift) & (kRadix - 1)]++;
+	};
+	auto scatter = [&](unsigned t)
+	{
+		size_t *c = counts.data() + t * kRadix;
+		size_t end = std::min(n, (t + 1) * chunk);
+		for (size_t i = t * chunk; i < end; i++)
+		{
+			size_t pos = c[(keys[i] >> shift) & (kRadix - 1)]++;
+			keys_tmp[pos] = keys[i];
+			perm_tmp[pos] = perm[i];
+		}
+	};
+
+	vector<std::thread> threads;
+	for (unsigned t = 1; t < num_threads; t++)
+		threads.push_back(std::thread(count, t));
+	count(0);
+	for (auto &thread : threads) thread.join();
+
+	// Offsets of digit d in chunk t
+	size_t offset = 0;
+	for (unsigned d = 0; d < kRadix; d++)
+	{
+		for (unsigned t = 0; t < num_threads; t++)
+		{
+			size_t c = counts[t * kRadix + d];
+			if (c == n) return false;
+			counts[t * kRadix + d] = offset;
+			offset += c;
+		}
+	}
+
+	threads.clear();
+	for (unsigned t = 1; t < num_threads; t++)
+		threads.push_back(std::thread(scatter, t));
+	scatter(0);
+	for (auto &thread : threads) thread.join();
+	keys.swap(keys_tmp);
+	perm.swap(perm_tmp);
+	return true;
+}
+
+vector<unsigned> SortTemplates(const vector<int> &data, unsigned dim, 
+                               unsigned n, bool descending)
+{
+	if (n == 0 || n + dim - 1 > data.size())
+		throw std::invalid_argument("invalid number of templates");
+	vector<unsigned> perm(n);
+	for (unsigned i = 0; i < n; i++) perm[i] = i;
+	if (dim == 0) return perm;
+
+	const int min_ = *std::min_element(data.cbegin(), data.cend());
+	const int max_ = *std::max_element(data.cbegin(), data.cend());
+	const uint64_t range = static_cast<uint64_t>(
+		static_cast<int64_t>(max_) - min_);
+	unsigned bits = 1;
+	while (bits < 64 && (range >> bits)) bits++;
+	// Coordinates packed in one key, the first one being the most 
+	// significant
+	const unsigned per_key = 64 / bits;
+	const unsigned num_keys = (dim + per_key - 1) / per_key;
+
+	unsigned num_threads = GetNumThreads();
+	if (n < (1u << 16)) num_threads = 1;
+	vector<uint64_t> keys(n), keys_tmp(n);
+	vector<unsigned> perm_tmp(n);
+	// LSD: the keys of the last coordinates are sorted first
+	for (unsigned k = num_keys; k-- > 0; )
+	{
+		unsigned begin = k * per_key;
+		unsigned end = std::min(dim, begin + per_key);
+		for (unsigned i = 0; i < n; i++)
+		{
+			const int *x = data.data() + perm[i];
+			uint64_t key = 0;
+			for (unsigned d = begin; d < end; d++)
+			{
+				uint64_t v = descending ? 
+					static_cast<int64_t>(max_) - x[d] : 
+					static_cast<int64_t>(x[d]) - min_;
+				key = (key << bits) | v;
+			}
+			keys[i] = key;
+		}
+		unsigned key_bits = bits * (end - begin);
+		for (unsigned shift = 0; shift < key_bits; shift += 11)
+		{
+			_RadixPass(keys, perm, keys_tmp, perm_tmp, shift, num_threads);
+		}
+	}
+	return perm;
+}
+
 bool IsPowerTwo(unsigned n)
 {
 	if (n == 1) return true;
@@ -129,6 +269,83 @@ int *readdata(char *filenm, unsigned long *filelen)
 	return data;
 }
 
+void TemplateBuffer::Gather(const vector<int> &data, 
+                            const vector<unsigned> &indices, unsigned dim)
+{
+	dim_ = dim;
+	size_ = indices.size();
+	stride_ = (size_ + 15) / 16 * 16;
+	if (buf_.size() < static_cast<size_t>(dim_) * stride_)
+		buf_.resize(static_cast<size_t>(dim_) * stride_);
+	for (unsigned d = 0; d < dim_; d++)
+	{
+		int *row = buf_.data() + d * stride_;
+		const int *src = data.data() + d;
+		for (unsigned i = 0; i < size_; i++)
+			row[i] = src[indices[i]];
+	}
+}
+
+template <typename T>
+void CountMatchedBlocks(const int *coords, size_t stride, 
+                        const int *q, size_t q_stride, 
+                        unsigned first, unsigned m, int r, 
+                        unsigned begin, unsigned end, 
+                        T *A, T *B, const double *weights)
+{
+	const unsigned kBlock = 256;
+	unsigned char ok[kBlock];
+	T a = 0, b = 0;
+	for (unsigned j0 = begin; j0 < end; j0 += kBlock)
+	{
+		const unsigned len = std::min(kBlock, end - j0);
+		for (unsigned t = 0; t < len; t++)
+			ok[t] = 1;
+		for (unsigned d = first; d < m; d++)
+		{
+			const int *x = coords + d * stride + j0;
+			const int lower = q[d * q_stride] - r;
+			const int upper = q[d * q_stride] + r;
+			for (unsigned t = 0; t < len; t++)
+				ok[t] &= (x[t] >= lower) & (x[t] <= upper);
+		}
+		const int *x = coords + m * stride + j0;
+		const int lower = q[m * q_stride] - r;
+		const int upper = q[m * q_stride] + r;
+		if (weights)
+		{
+			const double *w = weights + j0;
+			double weight_a = 0, weight_b = 0;
+			for (unsigned t = 0; t < len; t++)
+			{
+				double wa = ok[t] ? w[t] : 0.;
+				weight_a += wa;
+				weight_b += (x[t] >= lower) & (x[t] <= upper) ? wa : 0.;
+			}
+			a += static_cast<T>(weight_a);
+			b += static_cast<T>(weight_b);
+			continue;
+		}
+		unsigned count_a = 0, count_b = 0;
+		for (unsigned t = 0; t < len; t++)
+		{
+			count_a += ok[t];
+			count_b += ok[t] & (x[t] >= lower) & (x[t] <= upper);
+		}
+		a += count_a;
+		b += count_b;
+	}
+	*A += a;
+	*B += b;
+}
+
+template void CountMatchedBlocks<long long>(
+	const int *, size_t, const int *, size_t, unsigned, unsigned, int, 
+	unsigned, unsigned, long long *, long long *, const double *);
+template void CountMatchedBlocks<double>(
+	const int *, size_t, const int *, size_t, unsigned, unsigned, int, 
+	unsigned, unsigned, double *, double *, const double *);
+
 string ArgumentParser::getArg(const string &arg) 
 {
 	auto iter = std::find(arg_list.cbegin(), arg_list.cend(), arg);
@@ -9,6 +9,11 @@
 
 #include <vector>
 #include <string>
+#include <functional>
+#include <new>
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
 
 #include "RangeTree2.h"
 
@@ -23,12 +28,162 @@ int *readdata(char *filenm, unsigned long *filelen);
 
 vector<Point> GetPoints(const vector<int> &data, unsigned m);
 
+/*
+ * Sort the templates data[i], ..., data[i + dim - 1], 0 <= i < n, in 
+ * lexicographic order by a parallel LSD radix sort over packed keys. The 
+ * sort is stable, so equal templates keep the order of their indices and 
+ * the result does not depend on the number of threads.
+ *
+ * @return the indices of the templates in sorted order
+ */
+vector<unsigned> SortTemplates(const vector<int> &data, unsigned dim, 
+                               unsigned n, bool descending = false);
+
+// The number of threads used for parallel computation
+unsigned GetNumThreads();
+
+// Split [0, n) into contiguous chunks of at least min_chunk items and call 
+// f(begin, end) for each chunk on its own thread
+void ParallelFor(unsigned n, const std::function<void(unsigned, unsigned)> &f, 
+                 unsigned min_chunk = 4096);
+
 bool IsPowerTwo(unsigned n);
 double ComputeVarience(const vector<int> &data);
 double ComputeSum(const vector<double> &data);
 double EclideanDistance(const Point &p1, const Point &p2);
 double L1Distance(const Point &p1, const Point &p2);
 
+// Allocator returning memory aligned to Align bytes, e.g., for SIMD loads
+template <typename T, size_t Align>
+class aligned_allocator
+{
+public:
+    typedef T value_type;
+    template <typename U> struct rebind 
+    { 
+        typedef aligned_allocator<U, Align> other; 
+    };
+    aligned_allocator() = default;
+    template <typename U> 
+    aligned_allocator(const aligned_allocator<U, Align> &) {}
+    T *allocate(size_t n)
+    {
+        void *p = nullptr;
+        if (posix_memalign(&p, Align, n * sizeof(T))) throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+    void deallocate(T *p, size_t) { free(p); }
+};
+
+template <typename T, typename U, size_t Align>
+bool operator==(const aligned_allocator<T, Align> &, 
+                const aligned_allocator<U, Align> &) { return true; }
+template <typename T, typename U, size_t Align>
+bool operator!=(const aligned_allocator<T, Align> &, 
+                const aligned_allocator<U, Align> &) { return false; }
+
+/*
+ * Templates of a series gathered in a flat buffer coordinate by coordinate, 
+ * so that the d-th coordinates of all templates are contiguous. The buffer 
+ * is aligned for SIMD loads and its memory is reused by later gathers.
+ */
+class TemplateBuffer
+{
+public:
+    TemplateBuffer() : dim_(0), size_(0), stride_(0) {}
+    // Gather the templates data[i], ..., data[i + dim - 1] for i in indices
+    void Gather(const vector<int> &data, const vector<unsigned> &indices, 
+                unsigned dim);
+    unsigned dim() const { return dim_; }
+    unsigned size() const { return size_; }
+    // The d-th coordinates of all templates
+    const int *coord(unsigned d) const { return buf_.data() + d * stride_; }
+    // The distance between coord(d) and coord(d + 1)
+    unsigned stride() const { return stride_; }
+private:
+    vector<int, aligned_allocator<int, 64> > buf_;
+    unsigned dim_;
+    unsigned size_;
+    // size_ rounded up to a multiple of 16, so that each row is aligned
+    unsigned stride_;
+};
+
+/*
+ * Count the templates j, begin <= j < end, of a column-major buffer whose 
+ * d-th coordinates are coords[d * stride + j], within distance r of the 
+ * query q, whose d-th coordinate is q[d * q_stride], on the coordinates 
+ * first, ..., m - 1 (A) and first, ..., m (B), and add them to A and B. 
+ * The templates are compared by blocks, so that the comparisons of a block 
+ * are vectorized. Each match adds weights[j] if weights is not nullptr, and 
+ * 1 otherwise; T is long long or double.
+ */
+template <typename T>
+void CountMatchedBlocks(const int *coords, size_t stride, 
+                        const int *q, size_t q_stride, 
+                        unsigned first, unsigned m, int r, 
+                        unsigned begin, unsigned end, 
+                        T *A, T *B, const double *weights = nullptr);
+
+/*
+ * Open-addressing hash table from the coordinates of the occupied cells of
+ * a k-dimensional grid to the cell numbers 0, 1, ..., in insertion order.
+ */
+class CellTable
+{
+public:
+    CellTable(unsigned k, unsigned max_cells) : k_(k)
+    {
+        unsigned capacity = 2;
+        while (capacity < 2 * max_cells) capacity <<= 1;
+        slots_.assign(capacity, 0);
+    }
+    // The number of the cell, inserted if it is new
+    unsigned Insert(const long long *cell)
+    {
+        unsigned pos = _Hash(cell) & (slots_.size() - 1);
+        while (slots_[pos])
+        {
+            if (_Equal(slots_[pos] - 1, cell)) return slots_[pos] - 1;
+            pos = (pos + 1) & (slots_.size() - 1);
+        }
+        cells_.insert(cells_.end(), cell, cell + k_);
+        slots_[pos] = size();
+        return size() - 1;
+    }
+    // The number of the cell, or -1 if it is not occupied
+    long long Find(const long long *cell) const
+    {
+        unsigned pos = _Hash(cell) & (slots_.size() - 1);
+        while (slots_[pos])
+        {
+            if (_Equal(slots_[pos] - 1, cell)) return slots_[pos] - 1;
+            pos = (pos + 1) & (slots_.size() - 1);
+        }
+        return -1;
+    }
+    unsigned size() const { return cells_.size() / k_; }
+    const long long *cell(unsigned c) const { return cells_.data() + c * k_; }
+private:
+    uint64_t _Hash(const long long *cell) const
+    {
+        uint64_t h = 0x9E3779B97F4A7C15ull;
+        for (unsigned d = 0; d < k_; d++)
+        {
+            h = (h ^ static_cast<uint64_t>(cell[d])) * 0xFF51AFD7ED558CCDull;
+            h ^= h >> 32;
+        }
+        return h;
+    }
+    bool _Equal(unsigned c, const long long *cell) const
+    {
+        return std::equal(cell, cell + k_, cells_.begin() + c * k_);
+    }
+    unsigned k_;
+    // The cell number plus one of each slot, 0 for an empty slot
+    vector<unsigned> slots_;
+    vector<long long> cells_;
+};
+
 class ArgumentParser
 {
 public:
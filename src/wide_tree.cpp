@@ -0,0 +1,210 @@
+/* file: wide_tree.cpp
+ * date: 2026-10-19
+ * author: phree
+ *
+ * description: implementation of the wide bounding volume tree
+ */
+#include <algorithm>
+#include <limits.h>
+#include <stdexcept>
+
+#include "wide_tree.h"
+
+WideTree::WideTree(const vector<int> &data, unsigned dim, unsigned n)
+    : dim_(dim), n_(n), src_(data.data()), order_(n)
+{
+    if (dim == 0)
+        throw std::invalid_argument("dim == 0");
+    if (n == 0 || n + dim - 1 > data.size())
+        throw std::invalid_argument("invalid number of templates");
+    for (unsigned i = 0; i < n; i++)
+        order_[i] = i;
+    _Build(0, n);
+
+    coords_.resize(static_cast<size_t>(dim_) * n_);
+    for (unsigned d = 0; d < dim_; d++)
+    {
+        for (unsigned i = 0; i < n_; i++)
+            coords_[d * n_ + i] = src_[order_[i] + d];
+    }
+    src_ = nullptr;
+}
+
+// Split [begin, end) into at most parts parts by the median of the
+// coordinate with the largest spread
+void WideTree::_Split(unsigned begin, unsigned end, unsigned parts,
+                      vector<unsigned> &bounds)
+{
+    if (parts == 1 || end - begin <= kLeafSize)
+    {
+        bounds.push_back(end);
+        return;
+    }
+    unsigned k = 0;
+    int max_spread = -1;
+    for (unsigned d = 0; d < dim_; d++)
+    {
+        int lo = INT_MAX, hi = INT_MIN;
+        for (unsigned i = begin; i < end; i++)
+        {
+            lo = std::min(lo, src_[order_[i] + d]);
+            hi = std::max(hi, src_[order_[i] + d]);
+        }
+        if (hi - lo > max_spread)
+        {
+            max_spread = hi - lo;
+            k = d;
+        }
+    }
+    unsigned mid = begin + (end - begin) / 2;
+    const int *src = src_ + k;
+    std::nth_element(order_.begin() + begin, order_.begin() + mid,
+                     order_.begin() + end,
+                     [src] (unsigned i, unsigned j)
+                     {
+                         return src[i] < src[j];
+                     });
+    _Split(begin, mid, parts / 2, bounds);
+    _Split(mid, end, parts / 2, bounds);
+}
+
+unsigned WideTree::_Build(unsigned begin, unsigned end)
+{
+    unsigned node = child_.size() / kWidth;
+    lo_.resize(lo_.size() + dim_ * kWidth, INT_MAX);
+    hi_.resize(hi_.size() + dim_ * kWidth, INT_MIN);
+    child_.resize(child_.size() + kWidth, 0);
+    count_.resize(count_.size() + kWidth, 0);
+
+    vector<unsigned> bounds;
+    _Split(begin, end, kWidth, bounds);
+    unsigned part_begin = begin;
+    for (unsigned c = 0; c < bounds.size(); c++)
+    {
+        unsigned part_end = bounds[c];
+        for (unsigned d = 0; d < dim_; d++)
+        {
+            int lo = INT_MAX, hi = INT_MIN;
+            for (unsigned i = part_begin; i < part_end; i++)
+            {
+                lo = std::min(lo, src_[order_[i] + d]);
+                hi = std::max(hi, src_[order_[i] + d]);
+            }
+            lo_[(node * dim_ + d) * kWidth + c] = lo;
+            hi_[(node * dim_ + d) * kWidth + c] = hi;
+        }
+        count_[node * kWidth + c] = part_end - part_begin;
+        if (part_end - part_begin <= kLeafSize)
+        {
+            child_[node * kWidth + c] = -static_cast<int>(
+                leaf_begin_.size() + 1);
+            leaf_begin_.push_back(part_begin);
+            leaf_end_.push_back(part_end);
+        }
+        else
+        {
+            int child = static_cast<int>(_Build(part_begin, part_end));
+            child_[node * kWidth + c] = child;
+        }
+        part_begin = part_end;
+    }
+    return node;
+}
+
+void WideTree::CountAB(const int *q, int r, long long *a, long long *b) const
+{
+    _CountNode(0, q, r, true, true, a, b);
+}
+
+void WideTree::_CountNode(unsigned node, const int *q, int r,
+                          bool need_a, bool need_b,
+                          long long *a, long long *b) const
+{
+    // out: the box does not intersect [q - r, q + r]
+    // in: the box is contained in [q - r, q + r]
+    int out[kWidth], in[kWidth], out_a[kWidth], in_a[kWidth];
+    for (unsigned c = 0; c < kWidth; c++)
+    {
+        out[c] = 0;
+        in[c] = 1;
+    }
+    const int *lo = lo_.data() + node * dim_ * kWidth;
+    const int *hi = hi_.data() + node * dim_ * kWidth;
+    for (unsigned d = 0; d < dim_; d++)
+    {
+        if (d + 1 == dim_)
+        {
+            for (unsigned c = 0; c < kWidth; c++)
+            {
+                out_a[c] = out[c];
+                in_a[c] = in[c];
+            }
+        }
+        const int ql = q[d] - r, qh = q[d] + r;
+        const int *lo_d = lo + d * kWidth;
+        const int *hi_d = hi + d * kWidth;
+        for (unsigned c = 0; c < kWidth; c++)
+        {
+            out[c] |= (lo_d[c] > qh) | (hi_d[c] < ql);
+            in[c] &= (lo_d[c] >= ql) & (hi_d[c] <= qh);
+        }
+    }
+
+    const unsigned *count = count_.data() + node * kWidth;
+    const int *child = child_.data() + node * kWidth;
+    for (unsigned c = 0; c < kWidth; c++)
+    {
+        if (out_a[c] || count[c] == 0) continue;
+        bool child_a = need_a, child_b = need_b && !out[c];
+        if (child_a && in_a[c])
+        {
+            *a += count[c];
+            child_a = false;
+        }
+        if (child_b && in[c])
+        {
+            *b += count[c];
+            child_b = false;
+        }
+        if (!child_a && !child_b) continue;
+        if (child[c] >= 0)
+            _CountNode(child[c], q, r, child_a, child_b, a, b);
+        else
+            _CountLeaf(-child[c] - 1, q, r, child_a, child_b, a, b);
+    }
+}
+
+void WideTree::_CountLeaf(unsigned leaf, const int *q, int r,
+                          bool need_a, bool need_b,
+                          long long *a, long long *b) const
+{
+    const unsigned begin = leaf_begin_[leaf];
+    const unsigned len = leaf_end_[leaf] - begin;
+    unsigned char ok[kLeafSize];
+    for (unsigned i = 0; i < len; i++)
+        ok[i] = 1;
+    for (unsigned d = 0; d + 1 < dim_; d++)
+    {
+        const int ql = q[d] - r, qh = q[d] + r;
+        const int *x = coords_.data() + d * n_ + begin;
+        for (unsigned i = 0; i < len; i++)
+            ok[i] &= (x[i] >= ql) & (x[i] <= qh);
+    }
+    unsigned count = 0;
+    if (need_a)
+    {
+        for (unsigned i = 0; i < len; i++)
+            count += ok[i];
+        *a += count;
+    }
+    if (need_b)
+    {
+        const unsigned d = dim_ - 1;
+        const int ql = q[d] - r, qh = q[d] + r;
+        const int *x = coords_.data() + d * n_ + begin;
+        count = 0;
+        for (unsigned i = 0; i < len; i++)
+            count += ok[i] & (x[i] >= ql) & (x[i] <= qh);
+        *b += count;
+    }
+}
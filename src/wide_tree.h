@@ -0,0 +1,65 @@
+/* file: wide_tree.h
+ * date: 2026-10-19
+ * author: phree
+ *
+ * description: a wide bounding volume tree for fixed radius queries under
+ *   the Chebyshev distance. Each node has kWidth children whose boxes are
+ *   stored in SoA form, so that all children of a node are classified by
+ *   one pass of vector compares, and each leaf holds up to kLeafSize
+ *   templates which are matched by brute force.
+ */
+#ifndef __WIDE_TREE_H__
+#define __WIDE_TREE_H__
+
+#include <vector>
+
+using std::vector;
+
+class WideTree
+{
+public:
+    static const unsigned kWidth = 8;
+    static const unsigned kLeafSize = 32;
+    /*
+     * Build the tree on the templates data[i], ..., data[i + dim - 1] for
+     * 0 <= i < n.
+     */
+    WideTree(const vector<int> &data, unsigned dim, unsigned n);
+    /*
+     * Count the templates within distance r of q. a is the count over the
+     * first dim - 1 coordinates and b the count over all dim coordinates.
+     */
+    void CountAB(const int *q, int r, long long *a, long long *b) const;
+    unsigned dim() const { return dim_; }
+    unsigned size() const { return n_; }
+private:
+    unsigned _Build(unsigned begin, unsigned end);
+    void _Split(unsigned begin, unsigned end, unsigned parts,
+                vector<unsigned> &bounds);
+    void _CountNode(unsigned node, const int *q, int r, 
+                    bool need_a, bool need_b, 
+                    long long *a, long long *b) const;
+    void _CountLeaf(unsigned leaf, const int *q, int r, 
+                    bool need_a, bool need_b, 
+                    long long *a, long long *b) const;
+
+    unsigned dim_;
+    unsigned n_;
+    // The data the tree is built on, only valid while building
+    const int *src_;
+    // Template index of the i-th template in leaf order
+    vector<unsigned> order_;
+    // Coordinates in leaf order, coords_[d * n_ + i]
+    vector<int> coords_;
+    // Boxes of the children of node k: lo_[(k * dim_ + d) * kWidth + c]
+    vector<int> lo_;
+    vector<int> hi_;
+    // >= 0: an inner node; < 0: the leaf -(child + 1)
+    vector<int> child_;
+    vector<unsigned> count_;
+    // Templates [leaf_begin_[l], leaf_end_[l]) belong to leaf l
+    vector<unsigned> leaf_begin_;
+    vector<unsigned> leaf_end_;
+};
+
+#endif // __WIDE_TREE_H__